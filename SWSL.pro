@@ -2,6 +2,7 @@ TEMPLATE = app
 CONFIG += console
 CONFIG -= app_bundle
 CONFIG -= qt
+CONFIG += thread
 
 #QMAKE_CXXFLAGS += \
 #	-mcpu=cortex-a7 \
@@ -18,10 +19,20 @@ CONFIG -= qt
 #	-fopenmp \
 #	-pthread
 
-SOURCES += \
-    main.cpp \
+# Opcode counts, mask statistics and timing per shader, see swsl_profile.h
+#DEFINES += SWSL_PROFILE=1
+
+# The engine, built once per instruction set, see swsl_isa.h
+ISA_SOURCES = \
     swsl_gfx.cpp \
     swsl_buffers.cpp \
+    swsl_shader.cpp \
+    swsl_jit.cpp \
+    swsl_renderer.cpp
+
+SOURCES += \
+    $$ISA_SOURCES \
+    main.cpp \
     MiniLib/MGL/mglCamera.cpp \
     MiniLib/MGL/mglGraphics.cpp \
     MiniLib/MGL/mglImage.cpp \
@@ -38,13 +49,19 @@ SOURCES += \
     MiniLib/MTL/mtlParser.cpp \
     MiniLib/MTL/mtlRandom.cpp \
     MiniLib/MTL/mtlString.cpp \
-    swsl_shader.cpp \
     MiniLib/MTL/mtlPath.cpp \
     swsl_astgen.cpp \
     swsl_tokdisp.cpp \
     swsl_cpptrans.cpp \
     swsl_astgen_new.cpp \
-    swsl_json.cpp
+    swsl_json.cpp \
+    swsl_optimize.cpp \
+    swsl_bccomp.cpp \
+    swsl_image.cpp \
+    swsl_program.cpp \
+    swsl_isa.cpp \
+    swsl_profile.cpp \
+    swsl_thread.cpp
 
 HEADERS += \
     swsl_instr.h \
@@ -104,7 +121,56 @@ HEADERS += \
     MiniLib/MPL/mplAlloc.h \
     swsl_cpptrans.h \
     swsl_astgen_new.h \
-    swsl_json.h
+    swsl_json.h \
+    swsl_optimize.h \
+    swsl_bccomp.h \
+    swsl_jit.h \
+    swsl_image.h \
+    swsl_isa.h \
+    swsl_renderer.h \
+    swsl_profile.h \
+    swsl_thread.h
+
+# On x86-64 Linux the engine is compiled again for AVX2 and AVX-512 and CreateRenderer picks the widest
+# build the CPU supports, SWSL_ISA=sse|avx2|avx512 in the environment overrides the choice.
+# The builds share inline functions and template instantiations that are not in the renamed namespaces
+# (mtlArray<int>, mmlMin, the helpers in swsl_instr.h and so on). To keep the linker from picking an AVX
+# copy for baseline code, the objects of each build are compiled with hidden visibility and linked into a
+# single relocatable object whose symbols are then made local and whose COMDAT groups are dropped. Such
+# an object defines nothing the rest of the program can bind to, it only registers its renderer.
+linux:contains(QMAKE_HOST.arch, x86_64) {
+    ISA_CXXFLAGS = -fvisibility=hidden -fvisibility-inlines-hidden -fno-lto
+
+    isa_avx2.name = AVX2 ${QMAKE_FILE_IN}
+    isa_avx2.input = ISA_SOURCES
+    isa_avx2.output = ${QMAKE_VAR_OBJECTS_DIR}${QMAKE_FILE_BASE}_avx2$${first(QMAKE_EXT_OBJ)}
+    isa_avx2.commands = $$QMAKE_CXX -c $(CXXFLAGS) $$ISA_CXXFLAGS -mavx2 -mfma -DSWSL_ISA_AVX2 -Dmpl=mpl_avx2 $(INCPATH) ${QMAKE_FILE_IN} -o ${QMAKE_FILE_OUT}
+    isa_avx2.dependency_type = TYPE_C
+    isa_avx2.variable_out = ISA_AVX2_OBJECTS
+
+    isa_avx2_link.name = AVX2 engine
+    isa_avx2_link.input = ISA_AVX2_OBJECTS
+    isa_avx2_link.output = ${QMAKE_VAR_OBJECTS_DIR}swsl_engine_avx2$${first(QMAKE_EXT_OBJ)}
+    isa_avx2_link.commands = ld -r ${QMAKE_FILE_IN} -o ${QMAKE_FILE_OUT} && objcopy --localize-hidden --remove-section=.group ${QMAKE_FILE_OUT}
+    isa_avx2_link.CONFIG += combine
+    isa_avx2_link.variable_out = OBJECTS
+
+    isa_avx512.name = AVX-512 ${QMAKE_FILE_IN}
+    isa_avx512.input = ISA_SOURCES
+    isa_avx512.output = ${QMAKE_VAR_OBJECTS_DIR}${QMAKE_FILE_BASE}_avx512$${first(QMAKE_EXT_OBJ)}
+    isa_avx512.commands = $$QMAKE_CXX -c $(CXXFLAGS) $$ISA_CXXFLAGS -mavx512f -mavx2 -mfma -DSWSL_ISA_AVX512 -Dmpl=mpl_avx512 $(INCPATH) ${QMAKE_FILE_IN} -o ${QMAKE_FILE_OUT}
+    isa_avx512.dependency_type = TYPE_C
+    isa_avx512.variable_out = ISA_AVX512_OBJECTS
+
+    isa_avx512_link.name = AVX-512 engine
+    isa_avx512_link.input = ISA_AVX512_OBJECTS
+    isa_avx512_link.output = ${QMAKE_VAR_OBJECTS_DIR}swsl_engine_avx512$${first(QMAKE_EXT_OBJ)}
+    isa_avx512_link.commands = ld -r ${QMAKE_FILE_IN} -o ${QMAKE_FILE_OUT} && objcopy --localize-hidden --remove-section=.group ${QMAKE_FILE_OUT}
+    isa_avx512_link.CONFIG += combine
+    isa_avx512_link.variable_out = OBJECTS
+
+    QMAKE_EXTRA_COMPILERS += isa_avx2 isa_avx2_link isa_avx512 isa_avx512_link
+}
 
 macx: {
     OBJECTIVE_SOURCES += \
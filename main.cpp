@@ -2,6 +2,9 @@
 
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <ctime>
+#include <chrono>
 
 #include <SDL/SDL.h>
 
@@ -9,12 +12,21 @@
 #include "MiniLib/MGL/mglText.h"
 #include "MiniLib/MML/mmlMatrix.h"
 #include "MiniLib/MPL/mplAlloc.h"
+#include "MiniLib/MTL/mtlMemory.h"
 
 #include "swsl.h"
 #include "swsl_gfx.h"
 #include "swsl_aux.h"
 #include "swsl_astgen.h"
 #include "swsl_cpptrans.h"
+#include "swsl_bccomp.h"
+#include "swsl_image.h"
+#include "swsl_program.h"
+#include "swsl_isa.h"
+#include "swsl_renderer.h"
+#include "swsl_astgen_new.h"
+#include "swsl_json.h"
+#include "tmp_out.h"
 
 // Things I should look into:
 // Buffers should allocate an extra register at the edges so that screen resolutions that are not multiples of SWSL_WIDTH render properly
@@ -126,8 +138,6 @@ void Printer::SetColor(unsigned char _r, unsigned char _g, unsigned char _b)
 	b = _b;
 }
 
-#include <limits>
-
 void OutputSIMDInfo( void )
 {
 	std::cout << sizeof(char*) * CHAR_BIT << " bit binary" << std::endl;
@@ -144,6 +154,11 @@ void OutputSIMDInfo( void )
 				 "NEON"
 			 #endif
 				 << " @ " << MPL_WIDTH << " wide" << std::endl;
+	swsl::Renderer *renderer = swsl::CreateRenderer();
+	if (renderer != NULL) {
+		std::cout << swsl::GetIsaName(renderer->GetIsa()) << " engine @ " << renderer->GetWidth() << " wide selected" << std::endl;
+		delete renderer;
+	}
 }
 
 int PathTest( void )
@@ -223,13 +238,40 @@ int CppTranslatorTest( void )
 	return 0;
 }
 
+int BytecodeCompilerTest( void )
+{
+	swsl::SyntaxTreeGenerator gen;
+	std::cout << "Generating tree..." << std::flush;
+	swsl::SyntaxTree *t = gen.Generate("../swsl_samples/test.swsl");
+	std::cout << "done" << std::endl;
+	swsl::BytecodeCompiler c;
+	mtlArray<swsl::Instruction> program;
+	std::cout << "Compiling tree..." << std::flush;
+	if (!c.Compile(t, program)) {
+		std::cout << "failed" << std::endl;
+		const mtlItem<swsl::CompilerMessage> *i = c.GetErrors();
+		while (i != NULL) {
+			std::cout << " > " << i->GetItem().msg.GetChars() << ": " << i->GetItem().ref.GetChars() << std::endl;
+			i = i->GetNext();
+		}
+		delete t;
+		return 1;
+	}
+	std::cout << "done (" << program.GetSize() << " words)" << std::endl;
+	delete t;
+
+	swsl::Shader shader;
+	shader.SetProgram(program, program.GetSize());
+	std::cout << "Loading program..." << (shader.GetErrorCount() == 0 ? "done" : "failed") << std::endl;
+	return shader.GetErrorCount();
+}
+
 float scalar_max(const float &a, const float &b, bool)
 {
 	if (a < b) { return b; }
 	return a;
 }
 
-#include "tmp_out.h"
 int CodeCorrectnessTest( void )
 {
 	std::cout << "testing correctness (find max value)..." << std::endl;
@@ -294,6 +336,505 @@ void print_ch(const mtlChars &ch)
 	}
 }
 
+swsl::Instruction MakeInstr(swsl::InstructionSet instr)
+{
+	swsl::Instruction i;
+	i.instr = instr;
+	return i;
+}
+
+swsl::Instruction MakeAddr(int addr)
+{
+	swsl::Instruction i;
+	i.u_addr = (swsl::addr_t)addr;
+	return i;
+}
+
+swsl::Instruction MakeImm(float imm)
+{
+	swsl::Instruction i;
+	i.fl_imm = imm;
+	return i;
+}
+
+int ShaderDispatchTest( void )
+{
+	std::cout << "testing shader dispatch throughput..." << std::endl;
+
+	// slot 0: varying, slots 1-3: fragment, slot 4: temporary
+	const swsl::Instruction program[] = {
+		MakeAddr(4), MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(4), MakeAddr(0),
+		MakeInstr(swsl::FLT_MUL_MI),  MakeAddr(4), MakeImm(0.5f),
+		MakeInstr(swsl::FLT_ADD_MI),  MakeAddr(4), MakeImm(0.25f),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(1), MakeAddr(4),
+		MakeInstr(swsl::FLT_MUL_MM),  MakeAddr(4), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(2), MakeAddr(4),
+		MakeInstr(swsl::FLT_LT_MI),   MakeAddr(4), MakeImm(0.5f),
+		MakeInstr(swsl::TST_PUSH),
+		MakeInstr(swsl::TST_AND),
+		MakeInstr(swsl::FLT_MSET_MI), MakeAddr(3), MakeImm(1.0f),
+		MakeInstr(swsl::TST_POP),
+		MakeInstr(swsl::END)
+	};
+
+	swsl::Shader shader;
+	shader.SetProgram(program, sizeof(program) / sizeof(program[0]));
+
+	mpl::wide_float varying[1] = { 0.75f };
+	mpl::wide_float fragments[3];
+	swsl::Shader::InputArrays inputs = {
+		{ NULL, 0 },
+		{ varying, 1 },
+		{ fragments, 3 }
+	};
+	shader.SetInputArrays(inputs);
+	if (!shader.IsValid()) {
+		std::cout << "failed" << std::endl;
+		return 1;
+	}
+
+	const int               blocks = 1 << 20;
+	const mpl::wide_bool    mask   = true;
+	const mtlChars          names[] = { "switch", "threaded", "jit" };
+	const swsl::Shader::DispatchMode modes[] = { swsl::Shader::DISPATCH_SWITCH, swsl::Shader::DISPATCH_THREADED, swsl::Shader::DISPATCH_JIT };
+	for (int m = 0; m < 3; ++m) {
+		shader.SetDispatchMode(modes[m]);
+		if (shader.GetDispatchMode() != modes[m]) {
+			std::cout << "  ";
+			print_ch(names[m]);
+			std::cout << ": not supported by platform" << std::endl;
+			continue;
+		}
+		const clock_t start = clock();
+		for (int i = 0; i < blocks; ++i) {
+			shader.Run(mask);
+		}
+		const double secs = double(clock() - start) / CLOCKS_PER_SEC;
+		std::cout << "  ";
+		print_ch(names[m]);
+		std::cout << ": " << secs << " s, " << (secs > 0.0 ? (blocks * MPL_WIDTH) / (secs * 1000000.0) : 0.0) << " Mfragments/s" << std::endl;
+	}
+
+	std::cout << "done" << std::endl;
+	return 0;
+}
+
+int ShaderJitAliasTest( void )
+{
+	std::cout << "testing jit operand aliasing..." << std::endl;
+
+	// slot 0: varying, slots 1-2: fragment, slot 3: temporary
+	// the temporary is register allocated by the jit and is both destination and addend
+	const swsl::Instruction program[] = {
+		MakeAddr(3), MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),   MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_MAD_MMM),  MakeAddr(3), MakeAddr(0), MakeAddr(3),
+		MakeInstr(swsl::FLT_SET_MM),   MakeAddr(1), MakeAddr(3),
+		MakeInstr(swsl::FLT_SET_MM),   MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_MSUB_MMM), MakeAddr(3), MakeAddr(0), MakeAddr(3),
+		MakeInstr(swsl::FLT_SET_MM),   MakeAddr(2), MakeAddr(3),
+		MakeInstr(swsl::END)
+	};
+
+	swsl::Shader shader;
+	shader.SetProgram(program, sizeof(program) / sizeof(program[0]));
+
+	const float     in[MPL_WIDTH] = MPL_OFFSETS;
+	mpl::wide_float varying[1]    = { mpl::wide_float(in) };
+	mpl::wide_float fragments[2];
+	swsl::Shader::InputArrays inputs = {
+		{ NULL, 0 },
+		{ varying, 1 },
+		{ fragments, 2 }
+	};
+	shader.SetInputArrays(inputs);
+
+	float expected[2][MPL_WIDTH];
+	shader.SetDispatchMode(swsl::Shader::DISPATCH_SWITCH);
+	if (!shader.IsValid() || !shader.Run(true)) {
+		std::cout << "failed" << std::endl;
+		return 1;
+	}
+	fragments[0].to_scalar(expected[0]);
+	fragments[1].to_scalar(expected[1]);
+
+	shader.SetDispatchMode(swsl::Shader::DISPATCH_JIT);
+	if (shader.GetDispatchMode() != swsl::Shader::DISPATCH_JIT) {
+		std::cout << "  jit: not supported by platform" << std::endl;
+		std::cout << "done" << std::endl;
+		return 0;
+	}
+	fragments[0] = 0.0f;
+	fragments[1] = 0.0f;
+	if (!shader.Run(true)) {
+		std::cout << "failed" << std::endl;
+		return 1;
+	}
+
+	float f[MPL_WIDTH];
+	for (int c = 0; c < 2; ++c) {
+		fragments[c].to_scalar(f);
+		for (int i = 0; i < MPL_WIDTH; ++i) {
+			if (expected[c][i] != f[i]) {
+				std::cout << "mismatch" << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	std::cout << "done" << std::endl;
+	return 0;
+}
+
+int ShaderImageTest( void )
+{
+	std::cout << "testing shader image round trip..." << std::endl;
+
+	// slot 0: varying, slots 1-2: fragment, slot 3: temporary
+	const swsl::Instruction program[] = {
+		MakeAddr(3), MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_MUL_MI),  MakeAddr(3), MakeImm(0.5f),
+		MakeInstr(swsl::FLT_ADD_MI),  MakeAddr(3), MakeImm(0.25f),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(1), MakeAddr(3),
+		MakeInstr(swsl::FLT_LT_MI),   MakeAddr(0), MakeImm(0.5f),
+		MakeInstr(swsl::TST_PUSH),
+		MakeInstr(swsl::TST_AND),
+		MakeInstr(swsl::FLT_MSET_MI), MakeAddr(2), MakeImm(0.5f),
+		MakeInstr(swsl::TST_POP),
+		MakeInstr(swsl::END)
+	};
+	const int size = sizeof(program) / sizeof(program[0]);
+
+	swsl::Binary bin;
+	if (!swsl::Image::Write(program, size, 0, 1, 2, swsl::Image::Hash("image test"), bin)) {
+		std::cout << "failed to write" << std::endl;
+		return 1;
+	}
+	swsl::Image image;
+	if (!image.Load(bin.GetChars(), bin.GetSize())) {
+		std::cout << "failed to load" << std::endl;
+		return 1;
+	}
+	std::cout << "  " << bin.GetSize() << " bytes, " << image.GetCodeSize() << " words, " << image.GetPoolSize() << " constants" << std::endl;
+
+	swsl::Shader reference, loaded;
+	reference.SetProgram(program, size);
+	loaded.SetImage(image, image.FindEntry("main"));
+
+	const float     in[MPL_WIDTH] = MPL_OFFSETS;
+	mpl::wide_float varying[1]    = { mpl::wide_float(in) * mpl::wide_float(0.25f) };
+	mpl::wide_float expected[2]   = { 0.0f, 0.0f };
+	mpl::wide_float fragments[2]  = { 0.0f, 0.0f };
+	swsl::Shader::InputArrays reference_inputs = { { NULL, 0 }, { varying, 1 }, { expected, 2 } };
+	swsl::Shader::InputArrays loaded_inputs    = { { NULL, 0 }, { varying, 1 }, { fragments, 2 } };
+	reference.SetInputArrays(reference_inputs);
+	loaded.SetInputArrays(loaded_inputs);
+	if (!reference.IsValid() || !loaded.IsValid() || !reference.Run(true) || !loaded.Run(true)) {
+		std::cout << "failed to run" << std::endl;
+		return 1;
+	}
+
+	float e[MPL_WIDTH], f[MPL_WIDTH];
+	for (int c = 0; c < 2; ++c) {
+		expected[c].to_scalar(e);
+		fragments[c].to_scalar(f);
+		for (int i = 0; i < MPL_WIDTH; ++i) {
+			if (e[i] != f[i]) {
+				std::cout << "mismatch" << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	std::cout << "done" << std::endl;
+	return 0;
+}
+
+int ShaderSpecializeTest( void )
+{
+	std::cout << "testing shader specialization..." << std::endl;
+
+	// slot 0: constant, slot 1: varying, slot 2: fragment, slots 3-4: temporaries
+	// if (k > 0.5) { o = x * k; } else { o = x - k; }
+	const swsl::Instruction program[] = {
+		MakeAddr(3), MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),     MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_GT_MI),      MakeAddr(3), MakeImm(0.5f),
+		MakeInstr(swsl::TST_PUSH),
+		MakeInstr(swsl::TST_AND),
+		MakeInstr(swsl::TST_JMP_FAIL_I), MakeAddr(22),
+		MakeInstr(swsl::FLT_SET_MM),     MakeAddr(4), MakeAddr(1),
+		MakeInstr(swsl::FLT_MUL_MM),     MakeAddr(4), MakeAddr(0),
+		MakeInstr(swsl::FLT_MSET_MM),    MakeAddr(2), MakeAddr(4),
+		MakeInstr(swsl::TST_POP),
+		MakeInstr(swsl::TST_PUSH),
+		MakeInstr(swsl::FLT_GT_MI),      MakeAddr(3), MakeImm(0.5f),
+		MakeInstr(swsl::TST_INV),
+		MakeInstr(swsl::TST_OR),
+		MakeInstr(swsl::TST_INV),
+		MakeInstr(swsl::TST_JMP_FAIL_I), MakeAddr(41),
+		MakeInstr(swsl::FLT_SET_MM),     MakeAddr(4), MakeAddr(1),
+		MakeInstr(swsl::FLT_SUB_MM),     MakeAddr(4), MakeAddr(0),
+		MakeInstr(swsl::FLT_MSET_MM),    MakeAddr(2), MakeAddr(4),
+		MakeInstr(swsl::TST_POP),
+		MakeInstr(swsl::END)
+	};
+
+	swsl::Shader shader;
+	shader.SetProgram(program, sizeof(program) / sizeof(program[0]));
+	shader.SetInputLayout(1, 1, 1);
+	swsl::SpecializationCache cache(shader);
+
+	const float in[MPL_WIDTH] = MPL_OFFSETS;
+	const float ks[]          = { 0.0f, 2.0f, 0.0f };
+	for (int i = 0; i < 3; ++i) {
+		mpl::wide_float constant[1] = { ks[i] };
+		mpl::wide_float varying[1]  = { mpl::wide_float(in) };
+		mpl::wide_float expected[1] = { 0.0f };
+		mpl::wide_float fragments[1] = { 0.0f };
+		const swsl::Shader::InputArray constants = { constant, 1 };
+		const swsl::Shader *specialized = cache.Get(constants);
+		if (specialized == &shader) {
+			std::cout << "failed to specialize" << std::endl;
+			return 1;
+		}
+
+		swsl::ExecutionContext reference(shader), variant(*specialized);
+		swsl::Shader::InputArrays reference_inputs = { constants, { varying, 1 }, { expected, 1 } };
+		swsl::Shader::InputArrays variant_inputs   = { constants, { varying, 1 }, { fragments, 1 } };
+		reference.SetInputArrays(reference_inputs);
+		variant.SetInputArrays(variant_inputs);
+		if (!reference.IsValid() || !variant.IsValid() || !reference.Run(true) || !variant.Run(true)) {
+			std::cout << "failed to run" << std::endl;
+			return 1;
+		}
+
+		float e[MPL_WIDTH], f[MPL_WIDTH];
+		expected[0].to_scalar(e);
+		fragments[0].to_scalar(f);
+		for (int j = 0; j < MPL_WIDTH; ++j) {
+			if (e[j] != f[j]) {
+				std::cout << "mismatch" << std::endl;
+				return 1;
+			}
+		}
+	}
+	std::cout << "  " << cache.GetSize() << " variants" << std::endl;
+
+	std::cout << "done" << std::endl;
+	return 0;
+}
+
+int ShaderProfileTest( void )
+{
+	std::cout << "testing shader profile..." << std::endl;
+
+	// slot 0: varying, slot 1: fragment, slot 2: temporary
+	// if (x < 0.5) { o = x * 2; }
+	const swsl::Instruction program[] = {
+		MakeAddr(2), MakeAddr(2), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(2), MakeAddr(0),
+		MakeInstr(swsl::FLT_LT_MI),   MakeAddr(2), MakeImm(0.5f),
+		MakeInstr(swsl::TST_PUSH),
+		MakeInstr(swsl::TST_AND),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(2), MakeAddr(0),
+		MakeInstr(swsl::FLT_MUL_MI),  MakeAddr(2), MakeImm(2.0f),
+		MakeInstr(swsl::FLT_MSET_MM), MakeAddr(1), MakeAddr(2),
+		MakeInstr(swsl::TST_POP),
+		MakeInstr(swsl::END)
+	};
+
+	swsl::Shader shader;
+	shader.SetProgram(program, sizeof(program) / sizeof(program[0]));
+	shader.SetInputLayout(0, 1, 1);
+	swsl::ExecutionContext context(shader);
+
+	const float     offsets[MPL_WIDTH] = MPL_OFFSETS;
+	mpl::wide_float varying[1];
+	mpl::wide_float fragments[1];
+	swsl::Shader::InputArrays inputs = { { NULL, 0 }, { varying, 1 }, { fragments, 1 } };
+	context.SetInputArrays(inputs);
+	if (!context.IsValid()) {
+		std::cout << "failed" << std::endl;
+		return 1;
+	}
+
+	// Lanes pass, fail and diverge as x sweeps across the threshold
+	for (int i = 0; i < 64; ++i) {
+		varying[0] = mpl::wide_float(offsets) * mpl::wide_float(0.25f) + mpl::wide_float(i / 64.0f);
+		context.Run(true);
+	}
+
+#if SWSL_PROFILE
+	const swsl::Profile &profile = context.GetProfile();
+	profile.WriteText(std::cout);
+	std::ofstream fout("profile.json");
+	profile.WriteJson(fout);
+#else
+	std::cout << "  profiling disabled, build with SWSL_PROFILE=1" << std::endl;
+#endif
+
+	std::cout << "done" << std::endl;
+	return 0;
+}
+
+// Native counterpart of the program in ProgramVMTest, data holds r, g, b, u, k
+void NativeShade(void *data, const mpl::wide_bool &m0)
+{
+	mpl::wide_float *arr = (mpl::wide_float*)data;
+	arr[0] = mpl::wide_float::mov_if_true(arr[0], arr[3] * arr[4], m0);
+	const mpl::wide_bool m1 = (arr[3] > mpl::wide_float(0.3f)) & m0;
+	arr[1] = mpl::wide_float::mov_if_true(arr[1], arr[3] + mpl::wide_float(1.0f), m1);
+}
+
+int ProgramVMTest( void )
+{
+	std::cout << "testing interpreted against native shading..." << std::endl;
+
+	// slot 0: constant k, slot 1: varying u, slots 2-4: fragment rgb, slot 5: temporary
+	// r = u * k; if (u > 0.3) { g = u + 1; }
+	const swsl::Instruction program[] = {
+		MakeAddr(5), MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(5), MakeAddr(1),
+		MakeInstr(swsl::FLT_MUL_MM),  MakeAddr(5), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(2), MakeAddr(5),
+		MakeInstr(swsl::FLT_GT_MI),   MakeAddr(1), MakeImm(0.3f),
+		MakeInstr(swsl::TST_PUSH),
+		MakeInstr(swsl::TST_AND),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(5), MakeAddr(1),
+		MakeInstr(swsl::FLT_ADD_MI),  MakeAddr(5), MakeImm(1.0f),
+		MakeInstr(swsl::FLT_MSET_MM), MakeAddr(3), MakeAddr(5),
+		MakeInstr(swsl::TST_POP),
+		MakeInstr(swsl::END)
+	};
+
+	swsl::Binary bin;
+	swsl::ProgramVM vm;
+	if (!swsl::Image::Write(program, sizeof(program) / sizeof(program[0]), 1, 1, 3, 0, bin) || !vm.SetProgram(bin)) {
+		std::cout << "failed to load" << std::endl;
+		return 1;
+	}
+
+	const int           width = 256, height = 256, triangles = 1000;
+	swsl::rasterizer    interpreted, native;
+	const swsl::Point2D a = { 8, 4 }, b = { width - 8, height / 3 }, c = { width / 4, height - 4 };
+	mmlVector<1>        a_attr, b_attr, c_attr, const_attr;
+	a_attr[0] = 0.0f;
+	b_attr[0] = 1.0f;
+	c_attr[0] = 0.5f;
+	const_attr[0] = 2.0f;
+	interpreted.create_buffers(width, height);
+	native.create_buffers(width, height);
+	interpreted.set_thread_count(swsl::WorkerPool::GetHardwareThreadCount());
+	native.set_thread_count(swsl::WorkerPool::GetHardwareThreadCount());
+	if (vm.SetLayout(2, 1, 1) || !vm.SetLayout(interpreted.get_pixel_stride(), 1, 1)) {
+		std::cout << "failed to check layout" << std::endl;
+		return 1;
+	}
+
+	// Wall clock time, the processor time of clock() adds up the workers
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < triangles; ++i) {
+		interpreted.fill_triangle(a, b, c, a_attr, b_attr, c_attr, const_attr, vm);
+	}
+	const double vm_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < triangles; ++i) {
+		native.fill_triangle(a, b, c, a_attr, b_attr, c_attr, const_attr, NativeShade);
+	}
+	const double native_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "  interpreted: " << vm_secs << " s" << std::endl;
+	std::cout << "  native:      " << native_secs << " s" << std::endl;
+
+	mtlArray<mtlByte> vm_pixels, native_pixels;
+	vm_pixels.Create(width * height * 4);
+	native_pixels.Create(width * height * 4);
+	interpreted.write_color_buffer(0, 1, 2, &vm_pixels[0], 4, ByteOrder());
+	native.write_color_buffer(0, 1, 2, &native_pixels[0], 4, ByteOrder());
+	const mglByteOrder32 order = ByteOrder();
+	for (int i = 0; i < width * height * 4; i += 4) {
+		if (
+			vm_pixels[i + order.index.r] != native_pixels[i + order.index.r] ||
+			vm_pixels[i + order.index.g] != native_pixels[i + order.index.g] ||
+			vm_pixels[i + order.index.b] != native_pixels[i + order.index.b]
+		) {
+			std::cout << "mismatch" << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << "done" << std::endl;
+	return 0;
+}
+
+// Renders the same triangles with every build the CPU supports and compares them to the baseline. Builds may
+// contract multiplies and adds differently, so channels are allowed to be off by one.
+int RendererIsaTest( void )
+{
+	std::cout << "testing engine builds against the baseline..." << std::endl;
+
+	// slot 0: constant k, slot 1: varying u, slots 2-5: fragment rgb and depth, slot 6: temporary
+	// r = u * k; if (u > 0.3) { g = u + 1; }
+	const swsl::Instruction program[] = {
+		MakeAddr(6), MakeAddr(3), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(6), MakeAddr(1),
+		MakeInstr(swsl::FLT_MUL_MM),  MakeAddr(6), MakeAddr(0),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(2), MakeAddr(6),
+		MakeInstr(swsl::FLT_GT_MI),   MakeAddr(1), MakeImm(0.3f),
+		MakeInstr(swsl::TST_PUSH),
+		MakeInstr(swsl::TST_AND),
+		MakeInstr(swsl::FLT_SET_MM),  MakeAddr(6), MakeAddr(1),
+		MakeInstr(swsl::FLT_ADD_MI),  MakeAddr(6), MakeImm(1.0f),
+		MakeInstr(swsl::FLT_MSET_MM), MakeAddr(3), MakeAddr(6),
+		MakeInstr(swsl::TST_POP),
+		MakeInstr(swsl::END)
+	};
+
+	const int           width = 256, height = 256;
+	const swsl::Point3D a = { 8, 4, 0.5f, 1.0f }, b = { width - 8, height / 3, 0.2f, 0.5f }, c = { width / 4, height - 4, 0.8f, 0.25f };
+	const swsl::Point3D d = { width / 2, 0, 0.4f, 1.0f }, e = { width - 1, height - 1, 0.4f, 1.0f }, f = { 0, height / 2, 0.4f, 1.0f };
+	const float         attr[] = { 0.0f, 1.0f, 0.5f, 2.0f };
+
+	mtlArray<mtlByte> pixels[swsl::ISA_COUNT];
+	for (int i = 0; i < swsl::ISA_COUNT; ++i) {
+		swsl::Renderer *renderer = swsl::CreateRenderer((swsl::Isa)i);
+		if (renderer == NULL) {
+			std::cout << "  " << swsl::GetIsaName((swsl::Isa)i) << ": not available" << std::endl;
+			continue;
+		}
+		renderer->SetProgram(program, sizeof(program) / sizeof(program[0]));
+		renderer->SetThreadCount(4);
+		renderer->CreateBuffers(width, height, 4);
+		renderer->SetDepthComponent(3);
+		renderer->ClearBuffers();
+		if (!renderer->IsValid()) {
+			std::cout << "failed" << std::endl;
+			delete renderer;
+			return 1;
+		}
+		renderer->FillTriangle(a, b, c, attr, 1, 1);
+		renderer->FillTriangle(d, e, f, attr, 1, 1);
+		pixels[i].Create(width * height * 4);
+		mtlClear(&pixels[i][0], width * height * 4);
+		renderer->WriteColorBuffer(&pixels[i][0], 4, ByteOrder());
+		std::cout << "  " << swsl::GetIsaName((swsl::Isa)i) << ": " << renderer->GetWidth() << " wide" << std::endl;
+		delete renderer;
+
+		for (int j = 0; j < pixels[i].GetSize(); ++j) {
+			const int diff = (int)pixels[i][j] - (int)pixels[swsl::ISA_SSE][j];
+			if (diff < -1 || diff > 1) {
+				std::cout << "mismatch" << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	std::cout << "done" << std::endl;
+	return 0;
+}
+
 int ParserTest( void )
 {
 	std::cout << "testing parser..." << std::flush;
@@ -381,9 +922,6 @@ int ParserTest( void )
 	return 0;
 }
 
-#include "swsl_astgen_new.h"
-#include "swsl_json.h"
-
 int NewTokenizerTest( void )
 {
 	std::cout << "generating tree..." << std::flush;
@@ -408,9 +946,17 @@ int main(int, char**)
 	//return SplitTest();
 	//return PathTest();
 	//return CppTranslatorTest();
+	//return BytecodeCompilerTest();
 	//return CodeCorrectnessTest();
 	//return CodeLoopTest();
 	//return CodePerformanceTest();
+	//return ShaderDispatchTest();
+	//return ShaderJitAliasTest();
+	//return ShaderImageTest();
+	//return ShaderSpecializeTest();
+	//return ShaderProfileTest();
+	//return ProgramVMTest();
+	//return RendererIsaTest();
 	//return ParserTest();
 	return NewTokenizerTest();
 }
@@ -0,0 +1,676 @@
+#include "swsl_bccomp.h"
+
+void swsl::BytecodeCompiler::AddError(const mtlChars &msg, const mtlChars &ref)
+{
+	m_errors.AddLast();
+	m_errors.GetLast()->GetItem().msg.Copy(msg);
+	m_errors.GetLast()->GetItem().ref.Copy(ref);
+}
+
+void swsl::BytecodeCompiler::Emit(InstructionSet instr)
+{
+	Instruction i;
+	i.instr = instr;
+	m_program.Add(i);
+}
+
+void swsl::BytecodeCompiler::EmitAddr(int addr)
+{
+	Instruction i;
+	i.u_addr = (addr_t)addr;
+	m_program.Add(i);
+}
+
+void swsl::BytecodeCompiler::EmitImm(float imm)
+{
+	Instruction i;
+	i.fl_imm = imm;
+	m_program.Add(i);
+}
+
+void swsl::BytecodeCompiler::EmitOp(InstructionSet instr_mm, addr_t a, const Operand &b)
+{
+	// The _MI form of an instruction directly follows its _MM form
+	if (b.is_imm) {
+		Emit((InstructionSet)(instr_mm + 1));
+		EmitAddr(a);
+		EmitImm(b.imm);
+	} else {
+		Emit(instr_mm);
+		EmitAddr(a);
+		EmitAddr(b.slot);
+	}
+}
+
+int swsl::BytecodeCompiler::EmitJump(InstructionSet instr)
+{
+	Emit(instr);
+	EmitAddr(0);
+	return m_program.GetSize() - 1;
+}
+
+void swsl::BytecodeCompiler::PatchJump(int at, int target)
+{
+	m_program[at].u_addr = (addr_t)target;
+}
+
+int swsl::BytecodeCompiler::AllocSlots(int count)
+{
+	const int slot = m_top;
+	m_top += count;
+	if (m_top > (int)((addr_t)(-1))) {
+		AddError("[AllocSlots] Program exceeds maximum stack size", "");
+		m_top = slot;
+		return 0;
+	}
+	return slot;
+}
+
+int swsl::BytecodeCompiler::SizeOf(const Token *decl_type)
+{
+	const Token_DeclVarType *t = (decl_type != NULL && decl_type->type == Token::TOKEN_DECL_VAR_TYPE) ? dynamic_cast<const Token_DeclVarType*>(decl_type) : NULL;
+	if (t == NULL || t->arr_size != NULL) { return 0; }
+	if (t->is_std_type) {
+		return t->type_name.Compare("float", true) ? 1 : 0;
+	}
+	if (t->def_type == NULL || t->def_type->body == NULL) { return 0; }
+
+	int size = 0;
+	const mtlItem<Token*> *i = dynamic_cast<const Token_Body*>(t->def_type->body)->tokens.GetFirst();
+	while (i != NULL) {
+		if (i->GetItem()->type != Token::TOKEN_DECL_VAR) { return 0; }
+		const int mem_size = SizeOf(dynamic_cast<const Token_DeclVar*>(i->GetItem())->decl_type);
+		if (mem_size == 0) { return 0; }
+		size += mem_size;
+		i = i->GetNext();
+	}
+	return size;
+}
+
+int swsl::BytecodeCompiler::MemberOffset(const Token_DefType *def_type, const Token *member_decl_type)
+{
+	if (def_type == NULL || def_type->body == NULL) { return -1; }
+
+	int offset = 0;
+	const mtlItem<Token*> *i = dynamic_cast<const Token_Body*>(def_type->body)->tokens.GetFirst();
+	while (i != NULL) {
+		const Token_DeclVar *decl = dynamic_cast<const Token_DeclVar*>(i->GetItem());
+		if (decl == NULL) { return -1; }
+		if (decl->decl_type == member_decl_type) { return offset; }
+		offset += SizeOf(decl->decl_type);
+		i = i->GetNext();
+	}
+	return -1;
+}
+
+bool swsl::BytecodeCompiler::FindVariable(const Token *decl_type, addr_t &slot) const
+{
+	const mtlItem<Variable> *i = m_vars.GetLast();
+	while (i != NULL) {
+		if (i->GetItem().decl_type == decl_type) {
+			slot = i->GetItem().slot;
+			return true;
+		}
+		i = i->GetPrev();
+	}
+	return false;
+}
+
+bool swsl::BytecodeCompiler::DeclareVariable(const Token_DeclVar *t)
+{
+	const int size = SizeOf(t->decl_type);
+	if (size == 0) {
+		AddError("[DeclareVariable] Type not supported by bytecode", t->var_name);
+		return false;
+	}
+	Variable &var = m_vars.AddLast();
+	var.decl_type = t->decl_type;
+	var.slot      = (addr_t)AllocSlots(size);
+	return true;
+}
+
+bool swsl::BytecodeCompiler::Evaluate(const Token *expr, Operand &out)
+{
+	const int errs = m_errors.GetSize();
+	if (expr == NULL) {
+		AddError("[Evaluate] Missing expression", "");
+		return false;
+	}
+	Dispatch(expr);
+	out = m_result;
+	return m_errors.GetSize() == errs;
+}
+
+void swsl::BytecodeCompiler::ToTemp(Operand &op)
+{
+	if (!op.is_temp) {
+		const addr_t slot = (addr_t)AllocSlots(1);
+		EmitOp(FLT_SET_MM, slot, op);
+		op.slot    = slot;
+		op.is_imm  = false;
+		op.is_temp = true;
+	}
+}
+
+bool swsl::BytecodeCompiler::ResolveVar(const Token_ReadVar *t, int size, addr_t &slot)
+{
+	if (!FindVariable(t->decl_type, slot)) {
+		AddError("[ResolveVar] Variable not accessible from bytecode", t->var_name);
+		return false;
+	}
+
+	// Struct members are laid out contiguously in declaration order
+	const Token_ReadVar *v = t;
+	while (v != NULL) {
+		if (v->idx != NULL) {
+			AddError("[ResolveVar] Arrays not supported by bytecode", v->var_name);
+			return false;
+		}
+		if (v->member == NULL) { break; }
+		const Token_ReadVar *m = dynamic_cast<const Token_ReadVar*>(v->member);
+		if (m == NULL) {
+			Dispatch(v->member);
+			return false;
+		}
+		const int offset = MemberOffset(v->decl_type != NULL ? v->decl_type->def_type : NULL, m->decl_type);
+		if (offset < 0) {
+			AddError("[ResolveVar] Unknown member", m->var_name);
+			return false;
+		}
+		slot = (addr_t)(slot + offset);
+		v = m;
+	}
+	if (SizeOf(v->decl_type) != size) {
+		AddError(size == 1 ? "[ResolveVar] Only float values can be operated on" : "[ResolveVar] Expected a three component vector", v->var_name);
+		return false;
+	}
+	return true;
+}
+
+// Vector intrinsics operate on variables with three consecutive float slots
+bool swsl::BytecodeCompiler::ResolveVector(const Token *t, addr_t &slot)
+{
+	if (t == NULL || t->type != Token::TOKEN_READ_VAR) {
+		AddError("[ResolveVector] Vector arguments must be variables", "");
+		return false;
+	}
+	return ResolveVar(dynamic_cast<const Token_ReadVar*>(t), 3, slot);
+}
+
+bool swsl::BytecodeCompiler::EmitCondition(const Token *cond, Operand &lhs, Operand &rhs, InstructionSet &cmp, bool keep_operands)
+{
+	const Token_Expr *e = (cond != NULL && cond->type == Token::TOKEN_EXPR) ? dynamic_cast<const Token_Expr*>(cond) : NULL;
+	if (e == NULL || e->lhs == NULL) {
+		if (cond != NULL && cond->type == Token::TOKEN_ERR) { Dispatch(cond); }
+		else                                                { AddError("[EmitCondition] Condition must be a comparison", e != NULL ? e->op : mtlChars()); }
+		return false;
+	}
+
+	InstructionSet mirror;
+	if      (e->op.Compare("==", true)) { cmp = FLT_EQ_MM;  mirror = FLT_EQ_MM; }
+	else if (e->op.Compare("!=", true)) { cmp = FLT_NEQ_MM; mirror = FLT_NEQ_MM; }
+	else if (e->op.Compare("<", true))  { cmp = FLT_LT_MM;  mirror = FLT_GT_MM; }
+	else if (e->op.Compare("<=", true)) { cmp = FLT_LTE_MM; mirror = FLT_GTE_MM; }
+	else if (e->op.Compare(">", true))  { cmp = FLT_GT_MM;  mirror = FLT_LT_MM; }
+	else if (e->op.Compare(">=", true)) { cmp = FLT_GTE_MM; mirror = FLT_LTE_MM; }
+	else {
+		AddError("[EmitCondition] Condition must be a comparison", e->op);
+		return false;
+	}
+
+	if (!Evaluate(e->lhs, lhs) || !Evaluate(e->rhs, rhs)) { return false; }
+
+	// Only the right hand side of a comparison can be an immediate
+	if (lhs.is_imm && !rhs.is_imm) {
+		const Operand tmp = lhs;
+		lhs = rhs;
+		rhs = tmp;
+		cmp = mirror;
+	} else if (lhs.is_imm) {
+		ToTemp(lhs);
+	}
+	// The condition is evaluated again after the body, which may write to its variables
+	if (keep_operands) {
+		ToTemp(lhs);
+		if (!rhs.is_imm) { ToTemp(rhs); }
+	}
+	EmitOp(cmp, lhs.slot, rhs);
+	return true;
+}
+
+bool swsl::BytecodeCompiler::NeedsMerge(const Token *lhs) const
+{
+	// Variables declared at the current mask depth are invisible to masked out fragments
+	const Token *t = dynamic_cast<const Token_ReadVar*>(lhs)->decl_type;
+	return m_mask_depth != ((t != NULL) ? t->CountAscend(Token::TOKEN_IF|Token::TOKEN_WHILE) : 0);
+}
+
+void swsl::BytecodeCompiler::EmitElseMask(const Operand &lhs, const Operand &rhs, InstructionSet cmp)
+{
+	// mask = !(!mask | test) = mask & !test
+	EmitOp(cmp, lhs.slot, rhs);
+	Emit(TST_INV);
+	Emit(TST_OR);
+	Emit(TST_INV);
+}
+
+// v = normalize(u) writes all three components of v in one instruction
+void swsl::BytecodeCompiler::EmitNormalize(const Token *lhs, const Token_ReadFn *fn)
+{
+	addr_t dst, src;
+	if (fn->input.GetSize() != 1) {
+		AddError("[EmitNormalize] Wrong number of arguments", fn->fn_name);
+		return;
+	}
+	if (!ResolveVector(lhs, dst) || !ResolveVector(fn->input.GetFirst()->GetItem(), src)) { return; }
+
+	if (!NeedsMerge(lhs)) {
+		Emit(FLT_NORM3_MM);
+		EmitAddr(dst);
+		EmitAddr(src);
+		return;
+	}
+	const addr_t tmp = (addr_t)AllocSlots(3);
+	Emit(FLT_NORM3_MM);
+	EmitAddr(tmp);
+	EmitAddr(src);
+	for (int i = 0; i < 3; ++i) {
+		Emit(FLT_MSET_MM);
+		EmitAddr(dst + i);
+		EmitAddr(tmp + i);
+	}
+}
+
+void swsl::BytecodeCompiler::SetResult(addr_t slot, bool is_temp)
+{
+	m_result.slot    = slot;
+	m_result.imm     = 0.0f;
+	m_result.is_imm  = false;
+	m_result.is_temp = is_temp;
+}
+
+void swsl::BytecodeCompiler::SetResult(float imm)
+{
+	m_result.slot    = 0;
+	m_result.imm     = imm;
+	m_result.is_imm  = true;
+	m_result.is_temp = false;
+}
+
+void swsl::BytecodeCompiler::OutputProgram(mtlArray<Instruction> &out)
+{
+	if (m_errors.GetSize() == 0 && m_program.GetSize() > (int)((addr_t)(-1))) {
+		AddError("[OutputProgram] Program exceeds maximum size", "");
+	}
+	if (m_errors.GetSize() == 0) {
+		m_program[gMetaData_InputIndex].u_addr = (addr_t)m_inputs;
+		m_program[gMetaData_StackIndex].u_addr = 0; // computed by the loader
+		out.Create(m_program.GetSize());
+		for (int i = 0; i < out.GetSize(); ++i) {
+			out[i] = m_program[i];
+		}
+	} else {
+		out.Free();
+	}
+}
+
+void swsl::BytecodeCompiler::DispatchAlias(const Token_Alias*)
+{}
+
+void swsl::BytecodeCompiler::DispatchBody(const Token_Body *t)
+{
+	const int top = m_top;
+	Dispatch(t->tokens);
+	m_top = top;
+}
+
+void swsl::BytecodeCompiler::DispatchDeclFn(const Token_DeclFn*)
+{}
+
+void swsl::BytecodeCompiler::DispatchDeclVarType(const Token_DeclVarType*)
+{}
+
+void swsl::BytecodeCompiler::DispatchDeclVar(const Token_DeclVar *t)
+{
+	if (!DeclareVariable(t)) { return; }
+	const Variable &var  = m_vars.GetLast()->GetItem();
+	const int       size = SizeOf(t->decl_type);
+	const int       top  = m_top;
+	Operand value;
+	if (t->expr != NULL) {
+		if (Evaluate(t->expr, value)) {
+			EmitOp(FLT_SET_MM, var.slot, value);
+		}
+	} else {
+		// Frames are reused between blocks, uninitialized variables would leak values between fragments
+		value.slot    = 0;
+		value.imm     = 0.0f;
+		value.is_imm  = true;
+		value.is_temp = false;
+		for (int i = 0; i < size; ++i) {
+			EmitOp(FLT_SET_MM, (addr_t)(var.slot + i), value);
+		}
+	}
+	m_top = top;
+}
+
+void swsl::BytecodeCompiler::DispatchDefFn(const Token_DefFn *t)
+{
+	// Only the entry point is lowered, other functions are not callable from bytecode yet
+	if (!t->fn_name.Compare("main", true)) { return; }
+	if (m_has_main) {
+		AddError("[DispatchDefFn] Multiple definitions of main", t->fn_name);
+		return;
+	}
+	m_has_main = true;
+	if (t->decl_type != NULL) {
+		AddError("[DispatchDefFn] Entry point must return void", t->fn_name);
+	}
+
+	m_top = 0;
+	const mtlItem<Token*> *i = t->params.GetFirst();
+	while (i != NULL) {
+		if (i->GetItem()->type == Token::TOKEN_DECL_VAR) {
+			DeclareVariable(dynamic_cast<const Token_DeclVar*>(i->GetItem()));
+		} else {
+			Dispatch(i->GetItem());
+		}
+		i = i->GetNext();
+	}
+	m_inputs = m_top;
+
+	m_program[gMetaData_EntryIndex].u_addr = (addr_t)m_program.GetSize();
+	Dispatch(t->body);
+	Emit(END);
+}
+
+void swsl::BytecodeCompiler::DispatchDefType(const Token_DefType*)
+{}
+
+void swsl::BytecodeCompiler::DispatchErr(const Token_Err *t)
+{
+	AddError(t->msg, t->err);
+}
+
+void swsl::BytecodeCompiler::DispatchExpr(const Token_Expr *t)
+{
+	InstructionSet instr;
+	if      (t->op.Compare("+", true)) { instr = FLT_ADD_MM; }
+	else if (t->op.Compare("-", true)) { instr = FLT_SUB_MM; }
+	else if (t->op.Compare("*", true)) { instr = FLT_MUL_MM; }
+	else if (t->op.Compare("/", true)) { instr = FLT_DIV_MM; }
+	else {
+		AddError("[DispatchExpr] Comparisons are only allowed as conditions", t->op);
+		return;
+	}
+
+	Operand lhs, rhs;
+	if (t->lhs == NULL) {
+		// Unary operator, -x is lowered as 0 - x
+		if (instr != FLT_ADD_MM && instr != FLT_SUB_MM) {
+			AddError("[DispatchExpr] Missing operand", t->op);
+			return;
+		}
+		SetResult(0.0f);
+		lhs = m_result;
+	} else if (!Evaluate(t->lhs, lhs)) {
+		return;
+	}
+	if (!Evaluate(t->rhs, rhs)) { return; }
+
+	if (lhs.is_imm && rhs.is_imm) {
+		switch (instr) {
+		case FLT_ADD_MM: SetResult(lhs.imm + rhs.imm); break;
+		case FLT_SUB_MM: SetResult(lhs.imm - rhs.imm); break;
+		case FLT_MUL_MM: SetResult(lhs.imm * rhs.imm); break;
+		default:         SetResult(lhs.imm / rhs.imm); break;
+		}
+		return;
+	}
+
+	const addr_t slot = (addr_t)AllocSlots(1);
+	EmitOp(FLT_SET_MM, slot, lhs);
+	EmitOp(instr, slot, rhs);
+	SetResult(slot, true);
+}
+
+void swsl::BytecodeCompiler::DispatchFile(const Token_File *t)
+{
+	Dispatch(t->body);
+}
+
+void swsl::BytecodeCompiler::DispatchIf(const Token_If *t)
+{
+	const int top = m_top;
+	Operand lhs, rhs;
+	InstructionSet cmp;
+	if (!EmitCondition(t->cond, lhs, rhs, cmp, t->el_body != NULL)) {
+		m_top = top;
+		return;
+	}
+
+	++m_mask_depth;
+
+	Emit(TST_PUSH);
+	Emit(TST_AND);
+	int skip = EmitJump(TST_JMP_FAIL_I);
+	Dispatch(t->if_body);
+
+	if (t->el_body != NULL) {
+		PatchJump(skip, m_program.GetSize());
+		Emit(TST_POP);
+		Emit(TST_PUSH);
+		EmitElseMask(lhs, rhs, cmp);
+		skip = EmitJump(TST_JMP_FAIL_I);
+		Dispatch(t->el_body);
+	}
+
+	PatchJump(skip, m_program.GetSize());
+	Emit(TST_POP);
+
+	--m_mask_depth;
+	m_top = top;
+}
+
+// Only intrinsics can be called, each is lowered to a single instruction where possible
+void swsl::BytecodeCompiler::DispatchReadFn(const Token_ReadFn *t)
+{
+	InstructionSet instr;
+	int            params;
+	if      (t->fn_name.Compare("sqrt", true))  { instr = FLT_SQRT_MM;   params = 1; }
+	else if (t->fn_name.Compare("rsqrt", true)) { instr = FLT_RSQRT_MM;  params = 1; }
+	else if (t->fn_name.Compare("abs", true))   { instr = FLT_ABS_MM;    params = 1; }
+	else if (t->fn_name.Compare("floor", true)) { instr = FLT_FLOOR_MM;  params = 1; }
+	else if (t->fn_name.Compare("min", true))   { instr = FLT_MIN_MM;    params = 2; }
+	else if (t->fn_name.Compare("max", true))   { instr = FLT_MAX_MM;    params = 2; }
+	else if (t->fn_name.Compare("dot", true))   { instr = FLT_DOT3_MMM;  params = 2; }
+	else if (t->fn_name.Compare("clamp", true)) { instr = FLT_CLAMP_MMM; params = 3; }
+	else if (t->fn_name.Compare("normalize", true)) {
+		AddError("[DispatchReadFn] Vector results can only be assigned to a variable", t->fn_name);
+		return;
+	} else {
+		AddError("[DispatchReadFn] Function calls not supported by bytecode", t->fn_name);
+		return;
+	}
+
+	const Token *arg[3] = { NULL, NULL, NULL };
+	int argc = 0;
+	for (const mtlItem<Token*> *i = t->input.GetFirst(); i != NULL; i = i->GetNext()) {
+		if (argc < 3) { arg[argc] = i->GetItem(); }
+		++argc;
+	}
+	if (argc != params) {
+		AddError("[DispatchReadFn] Wrong number of arguments", t->fn_name);
+		return;
+	}
+
+	if (instr == FLT_DOT3_MMM) {
+		addr_t b, c;
+		if (!ResolveVector(arg[0], b) || !ResolveVector(arg[1], c)) { return; }
+		const addr_t slot = (addr_t)AllocSlots(1);
+		Emit(FLT_DOT3_MMM);
+		EmitAddr(slot);
+		EmitAddr(b);
+		EmitAddr(c);
+		SetResult(slot, true);
+		return;
+	}
+
+	Operand x, lo, hi;
+	if (!Evaluate(arg[0], x)) { return; }
+	if (params >= 2 && !Evaluate(arg[1], lo)) { return; }
+	if (params >= 3 && !Evaluate(arg[2], hi)) { return; }
+
+	const addr_t slot = (addr_t)AllocSlots(1);
+	if (params == 1) {
+		if (x.is_imm) {
+			EmitOp(FLT_SET_MM, slot, x);
+			x.slot = slot;
+		}
+		Emit(instr);
+		EmitAddr(slot);
+		EmitAddr(x.slot);
+	} else if (params == 2) {
+		EmitOp(FLT_SET_MM, slot, x);
+		EmitOp(instr, slot, lo);
+	} else if (!lo.is_imm && !hi.is_imm) {
+		EmitOp(FLT_SET_MM, slot, x);
+		Emit(FLT_CLAMP_MMM);
+		EmitAddr(slot);
+		EmitAddr(lo.slot);
+		EmitAddr(hi.slot);
+	} else {
+		// Immediate bounds are kept out of the frame
+		EmitOp(FLT_SET_MM, slot, x);
+		EmitOp(FLT_MAX_MM, slot, lo);
+		EmitOp(FLT_MIN_MM, slot, hi);
+	}
+	SetResult(slot, true);
+}
+
+void swsl::BytecodeCompiler::DispatchReadLit(const Token_ReadLit *t)
+{
+	if (t->lit_type == Token_ReadLit::TYPE_FLOAT) {
+		float f = 0.0f;
+		t->lit.ToFloat(f);
+		SetResult(f);
+	} else if (t->lit_type == Token_ReadLit::TYPE_INT) {
+		int i = 0;
+		t->lit.ToInt(i);
+		SetResult((float)i);
+	} else {
+		AddError("[DispatchReadLit] Boolean literals not supported by bytecode", t->lit);
+	}
+}
+
+void swsl::BytecodeCompiler::DispatchReadVar(const Token_ReadVar *t)
+{
+	addr_t slot;
+	if (ResolveVar(t, 1, slot)) {
+		SetResult(slot, false);
+	}
+}
+
+void swsl::BytecodeCompiler::DispatchRet(const Token_Ret *t)
+{
+	if (t->expr != NULL) {
+		AddError("[DispatchRet] Entry point must return void", "return");
+	} else if (m_mask_depth > 0) {
+		AddError("[DispatchRet] Conditional return not supported by bytecode", "return");
+	} else {
+		Emit(END);
+	}
+}
+
+void swsl::BytecodeCompiler::DispatchRoot(const SyntaxTree *t)
+{
+	Dispatch(t->file);
+}
+
+void swsl::BytecodeCompiler::DispatchSet(const Token_Set *t)
+{
+	if (t->lhs == NULL || t->lhs->type != Token::TOKEN_READ_VAR) {
+		Dispatch(t->lhs);
+		return;
+	}
+
+	const int top = m_top;
+	const Token_ReadFn *fn = (t->rhs != NULL && t->rhs->type == Token::TOKEN_READ_FN) ? dynamic_cast<const Token_ReadFn*>(t->rhs) : NULL;
+	if (fn != NULL && fn->fn_name.Compare("normalize", true)) {
+		EmitNormalize(t->lhs, fn);
+		m_top = top;
+		return;
+	}
+
+	addr_t slot;
+	Operand value;
+	if (ResolveVar(dynamic_cast<const Token_ReadVar*>(t->lhs), 1, slot) && Evaluate(t->rhs, value)) {
+		EmitOp(NeedsMerge(t->lhs) ? FLT_MSET_MM : FLT_SET_MM, slot, value);
+	}
+	m_top = top;
+}
+
+void swsl::BytecodeCompiler::DispatchWhile(const Token_While *t)
+{
+	const int top = m_top;
+	Operand lhs, rhs;
+	InstructionSet cmp;
+
+	++m_mask_depth;
+
+	// Rotated loop, the condition is tested before entering and at the end of each iteration
+	Emit(TST_PUSH);
+	if (!EmitCondition(t->cond, lhs, rhs, cmp, false)) {
+		--m_mask_depth;
+		m_top = top;
+		return;
+	}
+	m_top = top;
+	Emit(TST_AND);
+	const int exit = EmitJump(TST_JMP_FAIL_I);
+
+	const int loop = m_program.GetSize();
+	Dispatch(t->body);
+	EmitCondition(t->cond, lhs, rhs, cmp, false);
+	m_top = top;
+	Emit(TST_AND);
+	PatchJump(EmitJump(TST_JMP_PASS_I), loop);
+
+	PatchJump(exit, m_program.GetSize());
+	Emit(TST_POP);
+
+	--m_mask_depth;
+}
+
+bool swsl::BytecodeCompiler::Compile(const swsl::SyntaxTree *t, mtlArray<Instruction> &out_program)
+{
+	m_program.Free();
+	m_program.SetCapacity(1024);
+	m_vars.RemoveAll();
+	m_errors.RemoveAll();
+	m_top        = 0;
+	m_mask_depth = 0;
+	m_inputs     = 0;
+	m_has_main   = false;
+	SetResult(0.0f);
+
+	for (int i = 0; i < gMetaData_Size; ++i) {
+		EmitAddr(0);
+	}
+	Dispatch(t);
+	if (!m_has_main) {
+		AddError("[Compile] Missing entry point", "main");
+	}
+	OutputProgram(out_program);
+	return m_errors.GetSize() == 0;
+}
+
+int swsl::BytecodeCompiler::GetErrorCount( void ) const
+{
+	return m_errors.GetSize();
+}
+
+const mtlItem<swsl::CompilerMessage> *swsl::BytecodeCompiler::GetErrors( void ) const
+{
+	return m_errors.GetFirst();
+}
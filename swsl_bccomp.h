@@ -0,0 +1,95 @@
+#ifndef SWSL_BCCOMP_H_INCLUDED__
+#define SWSL_BCCOMP_H_INCLUDED__
+
+#include "swsl_tokdisp.h"
+#include "swsl_shader.h"
+
+namespace swsl
+{
+
+// Lowers a syntax tree to the instruction stream executed by swsl::Shader.
+// Parameters of main become the program inputs in declaration order, struct
+// parameters are flattened member by member. Everything else lives in frame
+// slots allocated above the inputs.
+class BytecodeCompiler : public swsl::TokenDispatcher
+{
+private:
+	// Result of an expression, either a frame slot or an immediate
+	struct Operand
+	{
+		addr_t slot;
+		float  imm;
+		bool   is_imm;
+		bool   is_temp; // slot is released at the end of the statement
+	};
+
+	struct Variable
+	{
+		const Token *decl_type; // Token_DeclVarType
+		addr_t       slot;
+	};
+
+private:
+	mtlArray<Instruction>    m_program;
+	mtlList<Variable>        m_vars;
+	mtlList<CompilerMessage> m_errors;
+	Operand                  m_result;
+	int                      m_top;        // first free frame slot
+	int                      m_mask_depth;
+	int                      m_inputs;
+	bool                     m_has_main;
+
+private:
+	void AddError(const mtlChars &msg, const mtlChars &ref);
+	void Emit(InstructionSet instr);
+	void EmitAddr(int addr);
+	void EmitImm(float imm);
+	void EmitOp(InstructionSet instr_mm, addr_t a, const Operand &b);
+	int  EmitJump(InstructionSet instr);
+	void PatchJump(int at, int target);
+	int  AllocSlots(int count);
+	int  SizeOf(const Token *decl_type);
+	int  MemberOffset(const Token_DefType *def_type, const Token *member_decl_type);
+	bool FindVariable(const Token *decl_type, addr_t &slot) const;
+	bool DeclareVariable(const Token_DeclVar *t);
+	bool Evaluate(const Token *expr, Operand &out);
+	void ToTemp(Operand &op);
+	bool ResolveVar(const Token_ReadVar *t, int size, addr_t &slot);
+	bool ResolveVector(const Token *t, addr_t &slot);
+	bool EmitCondition(const Token *cond, Operand &lhs, Operand &rhs, InstructionSet &cmp, bool keep_operands);
+	bool NeedsMerge(const Token *lhs) const;
+	void EmitElseMask(const Operand &lhs, const Operand &rhs, InstructionSet cmp);
+	void EmitNormalize(const Token *lhs, const Token_ReadFn *fn);
+	void SetResult(addr_t slot, bool is_temp);
+	void SetResult(float imm);
+	void OutputProgram(mtlArray<Instruction> &out);
+
+protected:
+	void DispatchAlias(const Token_Alias *t);
+	void DispatchBody(const Token_Body *t);
+	void DispatchDeclFn(const Token_DeclFn *t);
+	void DispatchDeclVarType(const Token_DeclVarType *t);
+	void DispatchDeclVar(const Token_DeclVar *t);
+	void DispatchDefFn(const Token_DefFn *t);
+	void DispatchDefType(const Token_DefType *t);
+	void DispatchErr(const Token_Err *t);
+	void DispatchExpr(const Token_Expr *t);
+	void DispatchFile(const Token_File *t);
+	void DispatchIf(const Token_If *t);
+	void DispatchReadFn(const Token_ReadFn *t);
+	void DispatchReadLit(const Token_ReadLit *t);
+	void DispatchReadVar(const Token_ReadVar *t);
+	void DispatchRet(const Token_Ret *t);
+	void DispatchRoot(const SyntaxTree *t);
+	void DispatchSet(const Token_Set *t);
+	void DispatchWhile(const Token_While *t);
+
+public:
+	bool                            Compile(const swsl::SyntaxTree *t, mtlArray<Instruction> &out_program);
+	int                             GetErrorCount( void ) const;
+	const mtlItem<CompilerMessage> *GetErrors( void ) const;
+};
+
+}
+
+#endif // SWSL_BCCOMP_H_INCLUDED__
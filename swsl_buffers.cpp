@@ -2,10 +2,21 @@
 
 #include "MiniLib/MML/mmlMath.h"
 
-void swsl::FrameBuffer::Create(int width, int height, int components)
+void swsl::FrameBuffer::Create(int width, int height, int components, swsl::FrameBuffer::BlockShape shape)
 {
-	width  = mmlMax(0, MPL_CEIL(width)) / MPL_WIDTH;
-	height = mmlMax(0, height);
+	// Block dimensions are powers of two
+	int block_height = 1;
+	if (shape == BLOCK_QUAD) {
+		while (block_height * block_height * 4 <= MPL_WIDTH) {
+			block_height *= 2;
+		}
+	}
+	m_block_width  = MPL_WIDTH / block_height;
+	m_block_height = block_height;
+	m_shape        = shape;
+
+	width  = (mmlMax(0, width) + m_block_width - 1) / m_block_width;
+	height = (mmlMax(0, height) + m_block_height - 1) / m_block_height;
 
 	if (width * height == 0) {
 		Destroy();
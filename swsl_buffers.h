@@ -5,34 +5,56 @@
 #include "MiniLib/MTL/mtlArray.h"
 #include "MiniLib/MTL/mtlBits.h"
 
+#include "swsl_isa.h"
+
 namespace swsl
 {
 
+	SWSL_ISA_BEGIN
+
 	// Linear buffers
 	// 1) Accessed in sequence
 	// 2) No compression
 	// 3) Modified by shaders
 
+	// Pixels are stored in blocks of MPL_WIDTH, one wide register per component. A block is either a row of
+	// MPL_WIDTH pixels or a small 2D footprint (2x2, 4x2 or 4x4 depending on MPL_WIDTH) whose lanes are stored
+	// row by row. Coordinates passed to GetComponent are in blocks along both axes.
+
 	class FrameBuffer
 	{
+	public:
+		enum BlockShape
+		{
+			BLOCK_ROW,  // MPL_WIDTH x 1
+			BLOCK_QUAD  // as square as MPL_WIDTH allows, at most twice as wide as high
+		};
+
 	private:
 		mtlArray<mpl::wide_float> m_data;
 		int                       m_width;
 		int                       m_height;
 		int                       m_components;
+		int                       m_block_width;
+		int                       m_block_height;
+		BlockShape                m_shape;
 
 	public:
-		FrameBuffer( void ) : m_data(), m_width(0), m_height(0), m_components(0) {}
+		FrameBuffer( void ) : m_data(), m_width(0), m_height(0), m_components(0), m_block_width(MPL_WIDTH), m_block_height(1), m_shape(BLOCK_ROW) {}
 
-		void Create(int width, int height, int components);
+		void Create(int width, int height, int components, BlockShape shape = BLOCK_ROW);
 		void Destroy( void );
 		void Clear( void );
 
-		int GetPackedWidth( void )         const { return m_width; }
-		int GetHeight( void )              const { return m_height; }
-		int GetPixelStride( void )         const { return m_components; }
-		int GetScanlineStride( void )      const { return m_components * m_width; }
-		int GetTotalComponentCount( void ) const { return m_data.GetSize(); }
+		int        GetPackedWidth( void )         const { return m_width; }
+		int        GetPackedHeight( void )        const { return m_height; }
+		int        GetHeight( void )              const { return m_height * m_block_height; }
+		int        GetBlockWidth( void )          const { return m_block_width; }
+		int        GetBlockHeight( void )         const { return m_block_height; }
+		BlockShape GetBlockShape( void )          const { return m_shape; }
+		int        GetPixelStride( void )         const { return m_components; }
+		int        GetScanlineStride( void )      const { return m_components * m_width; } // one row of blocks
+		int        GetTotalComponentCount( void ) const { return m_data.GetSize(); }
 
 		mpl::wide_float       *GetComponent(int x, int y, int c = 0)       { return m_data + (x + y * m_width) * m_components + c; }
 		const mpl::wide_float *GetComponent(int x, int y, int c = 0) const { return m_data + (x + y * m_width) * m_components + c; }
@@ -51,6 +73,8 @@ namespace swsl
 		int               m_height;
 	};
 
+	SWSL_ISA_END
+
 }
 
 #endif // SWSL_BUFFERS_H
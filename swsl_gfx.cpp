@@ -1,3 +1,5 @@
+#include <cfloat>
+
 #include "swsl_gfx.h"
 
 bool swsl::Rasterizer::IsTopLeft(const swsl::Point2D &a, const swsl::Point2D &b) const
@@ -19,31 +21,445 @@ swsl::Rasterizer::gfx_float swsl::Rasterizer::Orient2D(const swsl::Point2D &a, c
 
 int swsl::Rasterizer::GetMaskWidthStride( void ) const
 {
-	return ((m_mask_x2 - m_mask_x1) / MPL_WIDTH) * m_out_buffer.GetPixelStride();
+	return ((m_mask_x2 - m_mask_x1) / m_out_buffer.GetBlockWidth()) * m_out_buffer.GetPixelStride();
 }
 
 int swsl::Rasterizer::CeilIndex(int i) const
 {
-	return (i + MPL_WIDTH_MASK) & MPL_WIDTH_INVMASK;
+	const int mask = m_out_buffer.GetBlockWidth() - 1;
+	return (i + mask) & ~mask;
 }
 
 int swsl::Rasterizer::FloorIndex(int i) const
 {
-	return i & MPL_WIDTH_INVMASK;
+	return i & ~(m_out_buffer.GetBlockWidth() - 1);
+}
+
+int swsl::Rasterizer::CeilRow(int i) const
+{
+	const int mask = m_out_buffer.GetBlockHeight() - 1;
+	return (i + mask) & ~mask;
+}
+
+int swsl::Rasterizer::FloorRow(int i) const
+{
+	return i & ~(m_out_buffer.GetBlockHeight() - 1);
+}
+
+bool swsl::Rasterizer::HasDepth( void ) const
+{
+	return m_depth_component >= 0 && m_depth_component < m_out_buffer.GetPixelStride();
+}
+
+// Edge functions are linear, so a rectangle is outside an edge if all of its corners are, and inside the triangle
+// if all of its corners are inside every edge. Uses the same integer edge functions and biases as the blocks.
+swsl::Rasterizer::Coverage swsl::Rasterizer::Classify(const Triangle &t, int x1, int y1, int x2, int y2) const
+{
+	const swsl::Point2D  corners[4] = { { x1, y1 }, { x2, y1 }, { x1, y2 }, { x2, y2 } };
+	const swsl::Point2D *edges[3][2] = { { &t.b, &t.c }, { &t.c, &t.a }, { &t.a, &t.b } };
+	Coverage             coverage = COVER_FULL;
+	for (int e = 0; e < 3; ++e) {
+		const int bias   = IsTopLeft(*edges[e][0], *edges[e][1]) ? 0 : -1;
+		int       inside = 0;
+		for (int i = 0; i < 4; ++i) {
+			if (Orient2D(*edges[e][0], *edges[e][1], corners[i]) + bias >= 0) { ++inside; }
+		}
+		if (inside == 0) { return COVER_NONE; }
+		if (inside < 4)  { coverage = COVER_PARTIAL; }
+	}
+	return coverage;
+}
+
+// Depth is linear, so its nearest value over a rectangle is at one of the corners. The margin covers the rounding
+// of the per lane interpolation, the result is never farther than the depth of a fragment inside the rectangle.
+float swsl::Rasterizer::GetNearestDepth(const Triangle &t, int x1, int y1, int x2, int y2) const
+{
+	const swsl::Point2D corners[4] = { { x1, y1 }, { x2, y1 }, { x1, y2 }, { x2, y2 } };
+	const float         bias0 = IsTopLeft(t.b, t.c) ? 0.0f : -1.0f;
+	const float         bias1 = IsTopLeft(t.c, t.a) ? 0.0f : -1.0f;
+	const float         bias2 = IsTopLeft(t.a, t.b) ? 0.0f : -1.0f;
+	float               nearest = FLT_MAX;
+	for (int i = 0; i < 4; ++i) {
+		const float w0 = (float)Orient2D(t.b, t.c, corners[i]) + bias0;
+		const float w1 = (float)Orient2D(t.c, t.a, corners[i]) + bias1;
+		const float w2 = (float)Orient2D(t.a, t.b, corners[i]) + bias2;
+		nearest = mmlMin(nearest, (t.z[0] * w0 + t.z[1] * w1 + t.z[2] * w2) / (w0 + w1 + w2));
+	}
+	const float scale = mmlMax(mmlMax(t.z[0], -t.z[0]), mmlMax(t.z[1], -t.z[1]), mmlMax(t.z[2], -t.z[2]));
+	return nearest - scale * FLT_EPSILON * 16.0f;
+}
+
+// Nothing is culled against the tiles until the depth component has been cleared
+void swsl::Rasterizer::ResetDepthTiles( void )
+{
+	for (int i = 0; i < m_depth_tiles.GetSize(); ++i) {
+		m_depth_tiles[i] = FLT_MAX;
+	}
+}
+
+// Tiles inside the raster mask take the cleared depth, tiles it only overlaps keep the farther of the two
+void swsl::Rasterizer::ClearDepthTiles(float depth)
+{
+	if (m_mask_x1 >= m_mask_x2 || m_mask_y1 >= m_mask_y2) { return; }
+	for (int y = m_mask_y1 / COARSE_SIZE; y <= (m_mask_y2 - 1) / COARSE_SIZE; ++y) {
+		const bool inside_y = y * COARSE_SIZE >= m_mask_y1 && mmlMin((y + 1) * COARSE_SIZE, m_height) <= m_mask_y2;
+		for (int x = m_mask_x1 / COARSE_SIZE; x <= (m_mask_x2 - 1) / COARSE_SIZE; ++x) {
+			const bool inside = inside_y && x * COARSE_SIZE >= m_mask_x1 && mmlMin((x + 1) * COARSE_SIZE, m_width) <= m_mask_x2;
+			float     &tile   = m_depth_tiles[x + y * m_depth_tiles_x];
+			tile = inside ? depth : mmlMax(tile, depth);
+		}
+	}
+}
+
+void swsl::Rasterizer::ReserveBatch(Worker &worker, int blocks, int varying_count) const
+{
+	if (worker.batch.GetSize() < blocks) {
+		worker.batch.Create(blocks);
+	}
+	if (worker.batch_varying.GetSize() < blocks * varying_count) {
+		worker.batch_varying.Create(blocks * varying_count);
+	}
 }
 
-swsl::Rasterizer::Rasterizer( void ) : m_shader(NULL), m_width(0), m_height(0), m_mask_x1(0), m_mask_y1(0), m_mask_x2(0), m_mask_y2(0) {}
+// Bins are only kept when rasterizing on more than one thread
+void swsl::Rasterizer::CreateBins( void )
+{
+	m_tiles_x = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+	m_tiles_y = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+	ClearBins();
+	if (m_workers.GetSize() > 1) {
+		m_bins.Create(m_tiles_x * m_tiles_y);
+	} else {
+		m_bins.Free();
+	}
+}
+
+void swsl::Rasterizer::ClearBins( void )
+{
+	for (int i = 0; i < m_bins.GetSize(); ++i) {
+		m_bins[i].Free();
+	}
+	m_triangles.Free();
+	m_attributes.Free();
+}
+
+// All triangles of one flush are shaded with the same input layout, so a change of layout flushes the triangles
+// binned before it. The shader must not be changed while triangles are binned.
+void swsl::Rasterizer::Submit(const Triangle &t, const float *attr)
+{
+	if (m_workers.GetSize() <= 1) {
+		m_shader->SetInputLayout(t.cnst, t.var, m_out_buffer.GetPixelStride());
+		Rasterize(t, attr, t.x1, t.y1, t.x2, t.y2, m_workers[0]);
+		return;
+	}
+
+	if (m_triangles.GetSize() > 0 && (m_triangles[0].var != t.var || m_triangles[0].cnst != t.cnst)) {
+		Flush();
+	}
+	m_shader->SetInputLayout(t.cnst, t.var, m_out_buffer.GetPixelStride());
+
+	const int index = m_triangles.GetSize();
+	Triangle  binned = t;
+	binned.attr = m_attributes.GetSize();
+	for (int i = 0; i < t.var * 3 + t.cnst; ++i) {
+		m_attributes.Add(attr[i]);
+	}
+	m_triangles.Add(binned);
+
+	for (int y = t.y1 / TILE_SIZE; y <= t.y2 / TILE_SIZE; ++y) {
+		for (int x = t.x1 / TILE_SIZE; x <= t.x2 / TILE_SIZE; ++x) {
+			m_bins[x + y * m_tiles_x].Add(index);
+		}
+	}
+}
+
+// Rasterizes the part of the triangle that lies inside the inclusive bounds, x1 and y1 must be on a block boundry
+void swsl::Rasterizer::Rasterize(const Triangle &t, const float *attr, int x1, int y1, int x2, int y2, Worker &worker)
+{
+	// ISSUES
+	// Interpolated values seem to overflow at the edges
+
+	const int min_y = mmlMax(t.y1, y1);
+	const int max_y = mmlMin(t.y2, y2);
+	const int min_x = mmlMax(t.x1, x1);
+	const int max_x = mmlMin(t.x2, x2);
+	if (min_x > max_x || min_y > max_y) { return; }
+
+	const int var  = t.var;
+	const int cnst = t.cnst;
+	if (worker.registers.GetSize() < var * 3 + cnst) {
+		worker.registers.Create(var * 3 + cnst);
+	}
+
+	// Equal 1/w across the triangle cancels out of the perspective divide, leaving linear interpolation
+	const bool perspective = t.inv_w[0] != t.inv_w[1] || t.inv_w[0] != t.inv_w[2];
+
+	// Pump data for X number of pixels into these, varyings are divided by w when interpolated with perspective
+	gfx_float *a_reg         = worker.registers;
+	gfx_float *b_reg         = a_reg + var;
+	gfx_float *c_reg         = b_reg + var;
+	gfx_float *constants_arr = c_reg + var;
+	for (int i = 0; i < var; ++i) {
+		a_reg[i] = perspective ? attr[i] * t.inv_w[0] : attr[i];
+		b_reg[i] = perspective ? attr[var + i] * t.inv_w[1] : attr[var + i];
+		c_reg[i] = perspective ? attr[var * 2 + i] * t.inv_w[2] : attr[var * 2 + i];
+	}
+	for (int i = 0; i < cnst; ++i) {
+		constants_arr[i] = attr[var * 3 + i];
+	}
+
+	swsl::Shader::InputArrays shader_input = {
+		{ constants_arr, cnst },                // constant register
+		{ NULL, var },                          // varying register, bound per block in batch
+		{ NULL, m_out_buffer.GetPixelStride() } // fragment register, bound per block in batch
+	};
+	worker.context.SetInputArrays(shader_input);
+	if (!worker.context.IsValid()) { return; }
+
+	const swsl::Point2D &a = t.a;
+	const swsl::Point2D &b = t.b;
+	const swsl::Point2D &c = t.c;
+
+	// Triangle setup, edge functions step one block along either axis
+	const int       block_w = m_out_buffer.GetBlockWidth();
+	const int       block_h = m_out_buffer.GetBlockHeight();
+	const gfx_float A01 = (float)((a.y - b.y) * block_w);
+	const gfx_float B01 = (float)((b.x - a.x) * block_h);
+	const gfx_float A12 = (float)((b.y - c.y) * block_w);
+	const gfx_float B12 = (float)((c.x - b.x) * block_h);
+	const gfx_float A20 = (float)((c.y - a.y) * block_w);
+	const gfx_float B20 = (float)((a.x - c.x) * block_h);
+
+	const gfx_float bias0 = IsTopLeft(b, c) ? 0.0f : -1.0f;
+	const gfx_float bias1 = IsTopLeft(c, a) ? 0.0f : -1.0f;
+	const gfx_float bias2 = IsTopLeft(a, b) ? 0.0f : -1.0f;
+
+	// Lanes are stored row by row within a block
+	float x_offset[MPL_WIDTH];
+	float y_offset[MPL_WIDTH];
+	for (int n = 0; n < MPL_WIDTH; ++n) {
+		x_offset[n] = (float)(n % block_w);
+		y_offset[n] = (float)(n / block_w);
+	}
+
+	// Edge functions are exact integers, so any part of the triangle is rasterized as if walked from its own corner
+	wide_Point2D p = { gfx_float(min_x) + gfx_float(x_offset), gfx_float(min_y) + gfx_float(y_offset) };
+	gfx_float w0_row = Orient2D(b, c, p) + bias0;
+	gfx_float w1_row = Orient2D(c, a, p) + bias1;
+	gfx_float w2_row = Orient2D(a, b, p) + bias2;
+	const gfx_float sum_inv_area_x2 = (gfx_float)(1.0f) / (w0_row + w1_row + w2_row);
+
+	// Depth is linear in screen space and tested before shading, occluded lanes are never shaded
+	const bool      depth_test = HasDepth();
+	const int       depth_component = m_depth_component;
+	const gfx_float z0 = t.z[0], z1 = t.z[1], z2 = t.z[2];
+	const gfx_float iw0 = t.inv_w[0], iw1 = t.inv_w[1], iw2 = t.inv_w[2];
+
+	gfx_float *pixel_offset = (gfx_float*)m_out_buffer.GetComponent(min_x / block_w, min_y / block_h, 0);
+	const int  pixel_y_stride = m_out_buffer.GetScanlineStride();
+	const int  pixel_x_stride = m_out_buffer.GetPixelStride();
+
+	// Coverage tiles are aligned to the screen. They are classified up to the last pixel of the last block along
+	// both axes, so a fully covered tile never has lanes outside of the triangle.
+	const int tile_x1    = min_x & ~(COARSE_SIZE - 1);
+	const int tile_count = (max_x - tile_x1) / COARSE_SIZE + 1;
+	const int last_x     = FloorIndex(max_x) + block_w - 1;
+	const int last_y     = FloorRow(max_y) + block_h - 1;
+	int       tile_y1    = 0;
+	int       tile_y2    = 0;
+	if (worker.coverage.GetSize() < tile_count) {
+		worker.coverage.Create(tile_count);
+		worker.tile_depth.Create(tile_count);
+	}
+
+	// Covered blocks are collected per row of blocks and shaded in one batch
+	ReserveBatch(worker, (max_x - min_x) / block_w + 1, var);
+
+	for (int y = min_y; y <= max_y; y += block_h) {
+
+		// Tiles where the triangle is behind everything already drawn are culled before any block is tested
+		if (y == min_y || (y & (COARSE_SIZE - 1)) == 0) {
+			const float *depth_tiles = m_depth_tiles + (tile_x1 / COARSE_SIZE) + (y / COARSE_SIZE) * m_depth_tiles_x;
+			tile_y1 = y;
+			tile_y2 = mmlMin(y | (COARSE_SIZE - 1), last_y);
+			for (int i = 0; i < tile_count; ++i) {
+				const int tx1 = mmlMax(tile_x1 + i * COARSE_SIZE, min_x);
+				const int tx2 = mmlMin(tile_x1 + i * COARSE_SIZE + COARSE_SIZE - 1, last_x);
+				Coverage  coverage = Classify(t, tx1, y, tx2, tile_y2);
+				if (depth_test && coverage != COVER_NONE && GetNearestDepth(t, tx1, y, tx2, tile_y2) >= depth_tiles[i]) {
+					coverage = COVER_NONE;
+				}
+				worker.coverage[i]   = (unsigned char)coverage;
+				worker.tile_depth[i] = -FLT_MAX;
+			}
+		}
+
+		gfx_float w0 = w0_row;
+		gfx_float w1 = w1_row;
+		gfx_float w2 = w2_row;
+
+		int        batch_size = 0;
+		gfx_float *pixel      = pixel_offset;
+		for (int x = min_x; x <= max_x;) {
+
+			const int      tile     = (x - tile_x1) / COARSE_SIZE;
+			const int      tile_end = mmlMin(tile_x1 + (tile + 1) * COARSE_SIZE, max_x + 1);
+			const int      blocks   = (tile_end - x + block_w - 1) / block_w;
+			const Coverage coverage = (Coverage)worker.coverage[tile];
+
+			if (coverage == COVER_NONE) {
+				const gfx_float n = (float)blocks;
+				w0    += A12 * n;
+				w1    += A20 * n;
+				w2    += A01 * n;
+				pixel += pixel_x_stride * blocks;
+				x     += block_w * blocks;
+				continue;
+			}
+
+			for (int n = 0; n < blocks; ++n) {
+
+				gfx_bool fragment_mask = true;
+				if (coverage == COVER_PARTIAL) {
+					// Signs are tested separately, OR-ing the bits of floats can form a NaN that fails the test
+					fragment_mask = (w0 >= 0.0f) & (w1 >= 0.0f) & (w2 >= 0.0f);
+				}
+
+				if (depth_test && (coverage == COVER_FULL || !fragment_mask.all_fail())) {
+					const gfx_float z = (z0 * w0 + z1 * w1 + z2 * w2) * sum_inv_area_x2;
+					gfx_float      &depth = pixel[depth_component];
+					fragment_mask = fragment_mask & (z < depth);
+					depth = gfx_float::mov_if_true(depth, z, fragment_mask);
+					if (coverage == COVER_FULL) {
+						worker.tile_depth[tile] = gfx_float::max(worker.tile_depth[tile], depth);
+					}
+				}
+
+				if ((coverage == COVER_FULL && !depth_test) || !fragment_mask.all_fail()) {
+
+					const gfx_float scale = perspective ? (gfx_float)(1.0f) / (iw0 * w0 + iw1 * w1 + iw2 * w2) : sum_inv_area_x2;
+
+					gfx_float *varying = worker.batch_varying + batch_size * var;
+					for (int i = 0; i < var; ++i) {
+						varying[i] = (a_reg[i] * w0 + b_reg[i] * w1 + c_reg[i] * w2) * scale;
+					}
+
+					swsl::Shader::Block &block = worker.batch[batch_size++];
+					block.fragments = pixel;
+					block.varying   = varying;
+					block.mask      = fragment_mask;
+				}
+
+				w0 += A12;
+				w1 += A20;
+				w2 += A01;
+
+				pixel += pixel_x_stride;
+			}
+			x += block_w * blocks;
+		}
+
+		worker.context.RunBatch(worker.batch, batch_size);
+
+		// Every depth of a fully covered tile has been visited once its last row of blocks is done. Depths only move
+		// nearer, so tiles that are not visited in full keep their previous farthest depth.
+		if (depth_test && y + block_h > tile_y2 && (tile_y1 & (COARSE_SIZE - 1)) == 0 && (tile_y2 & (COARSE_SIZE - 1)) == COARSE_SIZE - 1) {
+			float *depth_tiles = m_depth_tiles + (tile_x1 / COARSE_SIZE) + (y / COARSE_SIZE) * m_depth_tiles_x;
+			for (int i = 0; i < tile_count; ++i) {
+				const int tx1 = tile_x1 + i * COARSE_SIZE;
+				if (worker.coverage[i] != COVER_FULL || tx1 < min_x || tx1 + COARSE_SIZE - 1 > last_x) { continue; }
+				float lanes[MPL_WIDTH];
+				worker.tile_depth[i].to_scalar(lanes);
+				float farthest = lanes[0];
+				for (int n = 1; n < MPL_WIDTH; ++n) {
+					farthest = mmlMax(farthest, lanes[n]);
+				}
+				depth_tiles[i] = farthest;
+			}
+		}
+
+		w0_row += B12;
+		w1_row += B20;
+		w2_row += B01;
+
+		pixel_offset += pixel_y_stride;
+	}
+}
+
+// Tiles are handed out one at a time, so workers that draw cheap tiles go on to take more of them
+void swsl::Rasterizer::RasterizeTiles(void *rasterizer, int worker)
+{
+	Rasterizer *r = (Rasterizer*)rasterizer;
+	Worker     &w = r->m_workers[worker];
+	for (int tile = r->m_next_tile++; tile < r->m_bins.GetSize(); tile = r->m_next_tile++) {
+		const mtlArray<int> &bin = r->m_bins[tile];
+		const int            x1  = (tile % r->m_tiles_x) * TILE_SIZE;
+		const int            y1  = (tile / r->m_tiles_x) * TILE_SIZE;
+		for (int i = 0; i < bin.GetSize(); ++i) {
+			const Triangle &t = r->m_triangles[bin[i]];
+			r->Rasterize(t, (const float*)r->m_attributes + t.attr, x1, y1, x1 + TILE_SIZE - 1, y1 + TILE_SIZE - 1, w);
+		}
+	}
+}
+
+swsl::Rasterizer::Rasterizer( void ) : m_shader(NULL), m_tiles_x(0), m_tiles_y(0), m_next_tile(0), m_width(0), m_height(0), m_mask_x1(0), m_mask_y1(0), m_mask_x2(0), m_mask_y2(0), m_depth_component(-1), m_depth_tiles_x(0), m_depth_tiles_y(0)
+{
+	m_workers.Create(1);
+}
 
 void swsl::Rasterizer::SetShader(swsl::Shader *shader)
 {
+	Flush();
 	m_shader = shader;
+	if (shader != NULL) {
+		for (int i = 0; i < m_workers.GetSize(); ++i) {
+			m_workers[i].context.SetShader(*shader);
+		}
+	}
+}
+
+// A count of one rasterizes triangles as they are submitted
+void swsl::Rasterizer::SetThreadCount(int count)
+{
+	Flush();
+	count = mmlMax(count, 1);
+	if (count == m_workers.GetSize()) { return; }
+	m_pool.Create(count);
+	m_workers.Create(count);
+	if (m_shader != NULL) {
+		for (int i = 0; i < count; ++i) {
+			m_workers[i].context.SetShader(*m_shader);
+		}
+	}
+	CreateBins();
 }
 
-void swsl::Rasterizer::CreateBuffers(int width, int height, int components)
+int swsl::Rasterizer::GetThreadCount( void ) const
 {
+	return m_workers.GetSize();
+}
+
+// Rasterizes the binned triangles, called implicitly before the frame buffer is read or cleared
+void swsl::Rasterizer::Flush( void )
+{
+	if (m_triangles.GetSize() == 0) { return; }
+	m_next_tile = 0;
+	m_pool.Run(RasterizeTiles, this);
+	ClearBins();
+}
+
+// Width and height are expected to be multiples of the block dimensions of the selected shape
+void swsl::Rasterizer::CreateBuffers(int width, int height, int components, swsl::FrameBuffer::BlockShape shape)
+{
+	Flush();
 	m_width = width;
 	m_height = height;
-	m_out_buffer.Create(width, height, components); // RGB + depth = 4 components
+	m_out_buffer.Create(width, height, components, shape); // RGB + depth = 4 components
+	m_depth_tiles_x = (width + COARSE_SIZE - 1) / COARSE_SIZE;
+	m_depth_tiles_y = (height + COARSE_SIZE - 1) / COARSE_SIZE;
+	m_depth_tiles.Create(m_depth_tiles_x * m_depth_tiles_y);
+	ResetDepthTiles();
+	CreateBins();
 	ResetRasterMask();
 }
 
@@ -53,9 +469,9 @@ void swsl::Rasterizer::SetRasterMask(int x1, int y1, int x2, int y2)
 	// due to the memory layout of the frame buffer
 
 	m_mask_x1 = mmlMax(FloorIndex(x1), 0);
-	m_mask_y1 = mmlMax(y1, 0);
+	m_mask_y1 = mmlMax(FloorRow(y1), 0);
 	m_mask_x2 = mmlMin(CeilIndex(x2), m_width);
-	m_mask_y2 = mmlMin(y2, m_height);
+	m_mask_y2 = mmlMin(CeilRow(y2), m_height);
 }
 
 void swsl::Rasterizer::ResetRasterMask( void )
@@ -66,20 +482,49 @@ void swsl::Rasterizer::ResetRasterMask( void )
 	m_mask_y2 = m_height;
 }
 
+// A negative component disables the depth test. The depth component is written as fragments pass the test. Shaders
+// may overwrite it, but not with a farther depth, since whole tiles are culled against the farthest depth written.
+void swsl::Rasterizer::SetDepthComponent(int component)
+{
+	Flush();
+	m_depth_component = component < 0 ? -1 : component;
+	ResetDepthTiles();
+}
+
+int swsl::Rasterizer::GetDepthComponent( void ) const
+{
+	return m_depth_component;
+}
+
+// Clears depth to the far plane at 1 and all other components to 0
 void swsl::Rasterizer::ClearBuffers( void )
 {
+	Flush();
 	int scanline_stride    = m_out_buffer.GetScanlineStride();
 	int mask_stride        = GetMaskWidthStride();
-	gfx_float *buffer_data = m_out_buffer.GetComponent(m_mask_x1 / MPL_WIDTH, m_mask_y1);
+	int block_h            = m_out_buffer.GetBlockHeight();
+	gfx_float *buffer_data = m_out_buffer.GetComponent(m_mask_x1 / m_out_buffer.GetBlockWidth(), m_mask_y1 / block_h);
 
-	for (int y = m_mask_y1; y < m_mask_y2; ++y) {
+	int pixel_stride       = m_out_buffer.GetPixelStride();
+	bool depth             = HasDepth();
+
+	for (int y = m_mask_y1; y < m_mask_y2; y += block_h) {
 		mtlClear(buffer_data, mask_stride);
+		if (depth) {
+			for (int x = m_depth_component; x < mask_stride; x += pixel_stride) {
+				buffer_data[x] = 1.0f;
+			}
+		}
 		buffer_data += scanline_stride;
 	}
+	if (depth) {
+		ClearDepthTiles(1.0f);
+	}
 }
 
 void swsl::Rasterizer::ClearBuffers(const float *component_data)
 {
+	Flush();
 	/*int        buffer_area   = m_out_buffer.GetWidth() * m_out_buffer.GetHeight();
 	int        buffer_stride = m_out_buffer.GetPixelStride();
 	gfx_float *buffer_data   = m_out_buffer.GetComponent(0,0);
@@ -93,9 +538,10 @@ void swsl::Rasterizer::ClearBuffers(const float *component_data)
 	int        scanline_stride = m_out_buffer.GetScanlineStride();
 	int        pixel_stride    = m_out_buffer.GetPixelStride();
 	int        mask_stride     = GetMaskWidthStride();
-	gfx_float *buffer_data     = m_out_buffer.GetComponent(m_mask_x1 / MPL_WIDTH, m_mask_y1);
+	int        block_h         = m_out_buffer.GetBlockHeight();
+	gfx_float *buffer_data     = m_out_buffer.GetComponent(m_mask_x1 / m_out_buffer.GetBlockWidth(), m_mask_y1 / block_h);
 
-	for (int y = m_mask_y1; y < m_mask_y2; ++y) {
+	for (int y = m_mask_y1; y < m_mask_y2; y += block_h) {
 		for (int x = 0; x < mask_stride;) {
 			for (int n = 0; n < pixel_stride; ++n, ++x) {
 				buffer_data[x] = component_data[n];
@@ -103,16 +549,23 @@ void swsl::Rasterizer::ClearBuffers(const float *component_data)
 		}
 		buffer_data += scanline_stride;
 	}
+	if (HasDepth()) {
+		ClearDepthTiles(component_data[m_depth_component]);
+	}
 }
 
 void swsl::Rasterizer::WriteColorBuffer(int src_r_idx, int src_g_idx, int src_b_idx, mtlByte *dst_pixels, int dst_bytes_per_pixel, mglByteOrder32 dst_byte_order)
 {
+	Flush();
+
+	const int        block_w = m_out_buffer.GetBlockWidth();
+	const int        block_h = m_out_buffer.GetBlockHeight();
 	const int        src_scanline_stride = m_out_buffer.GetScanlineStride();
 	const int        dst_scanline_stride = dst_bytes_per_pixel * m_width;
 	const int        src_pixel_stride = m_out_buffer.GetPixelStride();
-	const int        x1 = m_mask_x1 / MPL_WIDTH;
-	const int        x2 = m_mask_x2 / MPL_WIDTH;
-	const gfx_float *src_pixels = m_out_buffer.GetComponent(x1, m_mask_y1);
+	const int        x1 = m_mask_x1 / block_w;
+	const int        x2 = m_mask_x2 / block_w;
+	const gfx_float *src_pixels = m_out_buffer.GetComponent(x1, m_mask_y1 / block_h);
 	const gfx_float  scale = 255.0f;
 	gfx_float        rf, gf, bf;
 	gfx_int          ri, gi, bi;
@@ -120,7 +573,8 @@ void swsl::Rasterizer::WriteColorBuffer(int src_r_idx, int src_g_idx, int src_b_
 
 	dst_pixels += (m_mask_x1 + m_mask_y1 * m_width) * dst_bytes_per_pixel;
 
-	for (int y = m_mask_y1; y < m_mask_y2; ++y) {
+	for (int y = m_mask_y1; y < m_mask_y2; y += block_h) {
+		const int        rows      = mmlMin(block_h, m_mask_y2 - y); // the last row of blocks may extend past the buffer
 		mtlByte         *dst_pixel = dst_pixels;
 		const gfx_float *src_pixel = src_pixels;
 		for (int x = x1; x < x2; ++x) {
@@ -133,15 +587,19 @@ void swsl::Rasterizer::WriteColorBuffer(int src_r_idx, int src_g_idx, int src_b_
 			ri.to_scalar(rs);
 			gi.to_scalar(gs);
 			bi.to_scalar(bs);
-			for (int n = 0; n < MPL_WIDTH; ++n) {
-				dst_pixel[dst_byte_order.index.r] = rs[n];
-				dst_pixel[dst_byte_order.index.g] = gs[n];
-				dst_pixel[dst_byte_order.index.b] = bs[n];
-				dst_pixel += dst_bytes_per_pixel;
+			for (int row = 0, n = 0; row < rows; ++row) {
+				mtlByte *dst = dst_pixel + row * dst_scanline_stride;
+				for (int col = 0; col < block_w; ++col, ++n) {
+					dst[dst_byte_order.index.r] = rs[n];
+					dst[dst_byte_order.index.g] = gs[n];
+					dst[dst_byte_order.index.b] = bs[n];
+					dst += dst_bytes_per_pixel;
+				}
 			}
+			dst_pixel += dst_bytes_per_pixel * block_w;
 			src_pixel += src_pixel_stride;
 		}
-		dst_pixels += dst_scanline_stride;
+		dst_pixels += dst_scanline_stride * block_h;
 		src_pixels += src_scanline_stride;
 	}
 }
@@ -181,6 +639,32 @@ void swsl::Rasterizer::WriteColorBuffer(mtlByte *dst_pixels, int dst_bytes_per_p
 	WriteColorBuffer(0, 1, 2, dst_pixels, dst_bytes_per_pixel, dst_byte_order);
 }
 
+void swsl::Rasterizer::FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const float *attr, int var, int cnst)
+{
+	if (m_shader == NULL) { return; }
+
+	// AABB Clipping
+	Triangle t = {
+		{ a.x, a.y }, { b.x, b.y }, { c.x, c.y },
+		{ a.z, b.z, c.z },
+		{ a.inv_w, b.inv_w, c.inv_w },
+		0, 0, 0, 0, var, cnst, 0
+	};
+	t.x1 = mmlMax(FloorIndex(mmlMin(a.x, b.x, c.x)), m_mask_x1); // Make sure this is snapped to a block boundry
+	t.y1 = mmlMax(FloorRow(mmlMin(a.y, b.y, c.y)), m_mask_y1);
+	t.x2 = mmlMin(mmlMax(a.x, b.x, c.x), m_mask_x2 - 1);
+	t.y2 = mmlMin(mmlMax(a.y, b.y, c.y), m_mask_y2 - 1);
+	if (t.x1 > t.x2 || t.y1 > t.y2) { return; }
+
+	Submit(t, attr);
+}
+
+void swsl::Rasterizer::FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c)
+{
+	mmlVector<0> a_attr, b_attr, c_attr, const_attr;
+	FillTriangle(a, b, c, a_attr, b_attr, c_attr, const_attr);
+}
+
 void swsl::Rasterizer::FillTriangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c)
 {
 	mmlVector<0> a_attr, b_attr, c_attr, const_attr;
@@ -291,6 +775,16 @@ int swsl::rasterizer::floor_index(int i) const
 
 swsl::rasterizer::rasterizer( void ) : m_width(0), m_height(0), m_mask_x1(0), m_mask_y1(0), m_mask_x2(0), m_mask_y2(0) {}
 
+// The thread count includes the calling thread, a count of one fills triangles without synchronization
+void swsl::rasterizer::set_thread_count(int count)
+{
+	m_pool.Create(mmlMax(count, 1));
+}
+
+int swsl::rasterizer::get_thread_count( void ) const
+{
+	return m_pool.GetThreadCount();
+}
 
 void swsl::rasterizer::create_buffers(int width, int height, int components)
 {
@@ -300,6 +794,12 @@ void swsl::rasterizer::create_buffers(int width, int height, int components)
 	reset_raster_mask();
 }
 
+// Number of fragment components in front of the varyings in the data passed to shaders
+int swsl::rasterizer::get_pixel_stride( void ) const
+{
+	return m_out_buffer.GetPixelStride();
+}
+
 void swsl::rasterizer::set_raster_mask(int x1, int y1, int x2, int y2)
 {
 	m_mask_x1 = mmlMax(floor_index(x1), 0);
@@ -1,8 +1,12 @@
 #ifndef SWSL_GFX_H_INCLUDED__
 #define SWSL_GFX_H_INCLUDED__
 
+#include <atomic>
+#include <type_traits>
+
 #include "swsl_buffers.h"
 #include "swsl_shader.h"
+#include "swsl_thread.h"
 
 #include "MiniLib/MPL/mplWide.h"
 #include "MiniLib/MML/mmlVector.h"
@@ -19,7 +23,21 @@ namespace swsl
 		int y;
 	};
 
+	// Screen position with depth, smaller depth is nearer. Varyings are interpolated with perspective correction
+	// through inv_w, the reciprocal of the clip space w of the vertex.
+	struct Point3D
+	{
+		int   x;
+		int   y;
+		float z;
+		float inv_w;
+	};
+
+	SWSL_ISA_BEGIN
+
 	// A suggested implementation of a rasterizer.
+	// With more than one thread triangles are binned into screen tiles as they are submitted and rasterized
+	// tile by tile on a worker pool when flushed. Each tile draws its triangles in submission order.
 	class Rasterizer
 	{
 	private:
@@ -33,31 +51,96 @@ namespace swsl
 			gfx_float y;
 		};
 
+		// A triangle clipped to the raster mask. Attributes are the varyings of a, b and c followed by the constants.
+		struct Triangle
+		{
+			swsl::Point2D a, b, c;
+			float         z[3];           // depth of a, b and c
+			float         inv_w[3];       // 1/w of a, b and c
+			int           x1, y1, x2, y2; // inclusive bounds, x1 and y1 snapped to a block boundry
+			int           var;
+			int           cnst;
+			int           attr;           // offset into m_attributes when binned
+		};
+
+		// State of a thread shading triangles
+		struct Worker
+		{
+			swsl::ExecutionContext         context;       // input bindings and frame of m_shader
+			mtlArray<swsl::Shader::Block>  batch;         // blocks of one row of blocks, shaded with a single call
+			mtlArray<gfx_float>            batch_varying; // interpolated varyings for batch
+			mtlArray<gfx_float>            registers;     // attributes of the current triangle
+			mtlArray<unsigned char>        coverage;      // Coverage of the coarse tiles in the current row of tiles
+			mtlArray<gfx_float>            tile_depth;    // farthest depth written to the coarse tiles in the current row of tiles
+		};
+
+		// Coverage of a coarse tile by a triangle
+		enum Coverage
+		{
+			COVER_NONE,    // no pixel inside, skipped
+			COVER_PARTIAL, // edge tests per block
+			COVER_FULL     // every pixel inside, shaded without edge tests
+		};
+
 	private:
-		swsl::Shader      *m_shader; // only temp until we compile programs natively
-		swsl::FrameBuffer  m_out_buffer; // RGB + depth
-		int                m_width;
-		int                m_height;
-		int                m_mask_x1;
-		int                m_mask_y1;
-		int                m_mask_x2;
-		int                m_mask_y2;
+		static const int TILE_SIZE   = 64; // pixels along both axes, a multiple of the block dimensions
+		static const int COARSE_SIZE = 16; // pixels along both axes of a coverage tile, a multiple of the block dimensions that divides TILE_SIZE
 
 	private:
-		bool      IsTopLeft(const swsl::Point2D &a, const swsl::Point2D &b) const;
-		int       Orient2D(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c) const;
-		gfx_float Orient2D(const swsl::Point2D &a, const swsl::Point2D &b, const wide_Point2D &c) const;
-		int       GetMaskWidthStride( void ) const;
-		int       CeilIndex(int i) const;
-		int       FloorIndex(int i) const;
+		swsl::Shader                  *m_shader; // only temp until we compile programs natively
+		swsl::FrameBuffer              m_out_buffer; // RGB + depth
+		mtlArray<Worker>               m_workers; // the calling thread is worker 0
+		swsl::WorkerPool               m_pool;
+		mtlArray<Triangle>             m_triangles; // binned triangles in submission order
+		mtlArray<float>                m_attributes;
+		mtlArray< mtlArray<int> >      m_bins; // indices into m_triangles per tile
+		int                            m_tiles_x;
+		int                            m_tiles_y;
+		std::atomic<int>               m_next_tile;
+		int                            m_width;
+		int                            m_height;
+		int                            m_mask_x1;
+		int                            m_mask_y1;
+		int                            m_mask_x2;
+		int                            m_mask_y2;
+		int                            m_depth_component; // negative when depth is not tested
+		mtlArray<float>                m_depth_tiles; // farthest depth per coarse tile, never nearer than the depth buffer
+		int                            m_depth_tiles_x;
+		int                            m_depth_tiles_y;
+
+	private:
+		bool        IsTopLeft(const swsl::Point2D &a, const swsl::Point2D &b) const;
+		int         Orient2D(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c) const;
+		gfx_float   Orient2D(const swsl::Point2D &a, const swsl::Point2D &b, const wide_Point2D &c) const;
+		int         GetMaskWidthStride( void ) const;
+		int         CeilIndex(int i) const;
+		int         FloorIndex(int i) const;
+		int         CeilRow(int i) const;
+		int         FloorRow(int i) const;
+		bool        HasDepth( void ) const;
+		Coverage    Classify(const Triangle &t, int x1, int y1, int x2, int y2) const;
+		float       GetNearestDepth(const Triangle &t, int x1, int y1, int x2, int y2) const;
+		void        ResetDepthTiles( void );
+		void        ClearDepthTiles(float depth);
+		void        ReserveBatch(Worker &worker, int blocks, int varying_count) const;
+		void        CreateBins( void );
+		void        ClearBins( void );
+		void        Submit(const Triangle &t, const float *attr);
+		void        Rasterize(const Triangle &t, const float *attr, int x1, int y1, int x2, int y2, Worker &worker);
+		static void RasterizeTiles(void *rasterizer, int worker);
 
 	public:
 		Rasterizer( void );
 
 		void SetShader(swsl::Shader *shader);
-		void CreateBuffers(int width, int height, int components = 3);
+		void SetThreadCount(int count);
+		int  GetThreadCount( void ) const;
+		void Flush( void );
+		void CreateBuffers(int width, int height, int components = 3, swsl::FrameBuffer::BlockShape shape = swsl::FrameBuffer::BLOCK_ROW);
 		void SetRasterMask(int x1, int y1, int x2, int y2);
 		void ResetRasterMask( void );
+		void SetDepthComponent(int component);
+		int  GetDepthComponent( void ) const;
 		void ClearBuffers( void );
 		void ClearBuffers(const float *component_data);
 		void WriteColorBuffer(int src_r_idx, int src_g_idx, int src_b_idx, mtlByte *dst_pixels, int dst_bytes_per_pixel, mglByteOrder32 dst_byte_order);
@@ -75,6 +158,20 @@ namespace swsl
 		template < int n >
 		void FillRectangle(const swsl::swsl::Point2D &a, const swsl::swsl::Point2D &b, const mmlVector<n> &aa, const mmlVector<n> &ab, const mmlVector<n> &ba, const mmlVector<n> &bb);*/
 
+		template < int var, int cnst >
+		void FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, const mmlVector<cnst> &const_attr);
+
+		template < int var >
+		void FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr);
+
+		template < int cnst >
+		void FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const mmlVector<cnst> &const_attr);
+
+		void FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c);
+
+		// attr holds var varyings of a, b and c in turn followed by cnst constants
+		void FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const float *attr, int var, int cnst);
+
 		template < int var, int cnst >
 		void FillTriangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, const mmlVector<cnst> &const_attr);
 
@@ -90,6 +187,10 @@ namespace swsl
 
 
 	// Reference implementation for native rasterizer
+	// Shaders are functions or functors called as shader(void *data, const mpl::wide_bool &mask). They are taken
+	// by forwarding reference, so temporaries are accepted and stateful functors such as ProgramVM are not copied
+	// per triangle. Triangles are split into tiles shaded by a worker pool. With more than one thread every worker
+	// shades with a copy of its own, so the given shader is only read and needs to be copyable.
 
 	class rasterizer
 	{
@@ -104,8 +205,32 @@ namespace swsl
 			gfx_float y;
 		};
 
+		// Setup of the triangle being filled, shared by the workers that shade its tiles
+		template < int var, int cnst, typename shader_t >
+		struct fill_job
+		{
+			rasterizer       *r;
+			shader_t         *shader;
+			gfx_float         a_reg[var];
+			gfx_float         b_reg[var];
+			gfx_float         c_reg[var];
+			gfx_float         cnst_reg[cnst];
+			gfx_float         A01, B01, A12, B12, A20, B20; // edge steps per block and per row
+			gfx_float         w0, w1, w2;                   // edge functions at min_x, min_y
+			gfx_float         sum_inv_area_x2;
+			int               min_x, min_y, max_x, max_y;
+			int               tile_x, tile_y;               // first tile of the bounding box
+			int               tiles_x;
+			int               tile_count;
+			std::atomic<int>  next_tile;
+		};
+
+	private:
+		static const int TILE_SIZE = 64; // pixels along both axes, a multiple of the block width
+
 	private:
 		swsl::FrameBuffer  m_out_buffer; // RGB + depth
+		swsl::WorkerPool   m_pool;
 		int                m_width;
 		int                m_height;
 		int                m_mask_x1;
@@ -113,6 +238,10 @@ namespace swsl
 		int                m_mask_x2;
 		int                m_mask_y2;
 
+	private:
+		rasterizer(const rasterizer&) {}
+		rasterizer &operator=(const rasterizer&) { return *this; }
+
 	private:
 		bool      is_top_left(const swsl::Point2D &a, const swsl::Point2D &b) const;
 		int       orient_2d(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c) const;
@@ -121,9 +250,17 @@ namespace swsl
 		int       ceil_index(int i) const;
 		int       floor_index(int i) const;
 
+		template < int var, int cnst, typename shader_t, typename worker_shader_t >
+		void shade_tiles(fill_job<var, cnst, shader_t> &job, worker_shader_t &shader);
+
+		template < int var, int cnst, typename shader_t >
+		static void fill_tiles(void *job, int worker);
+
 	public:
 		rasterizer( void );
 
+		void set_thread_count(int count);
+		int  get_thread_count( void ) const;
 		void create_buffers(int width, int height, int components = 3);
 		void set_raster_mask(int x1, int y1, int x2, int y2);
 		void reset_raster_mask( void );
@@ -131,120 +268,62 @@ namespace swsl
 		void clear_buffers(const float *component_data);
 		void write_color_buffer(int src_r_idx, int src_g_idx, int src_b_idx, mtlByte *dst_pixels, int dst_bytes_per_pixel, mglByteOrder32 dst_byte_order);
 		void write_color_buffer(mtlByte *dst_pixels, int dst_bytes_per_pixel, mglByteOrder32 dst_byte_order);
+		int  get_pixel_stride( void ) const;
 
 		template < int var, int cnst, typename shader_t >
-		void fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, const mmlVector<cnst> &const_attr, shader_t shader);
+		void fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, const mmlVector<cnst> &const_attr, shader_t &&shader);
 
 		template < int var, typename shader_t >
-		void fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, shader_t shader);
+		void fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, shader_t &&shader);
 
 		template < int cnst, typename shader_t >
-		void fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<cnst> &const_attr, shader_t shader);
+		void fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<cnst> &const_attr, shader_t &&shader);
 
 		template < typename shader_t >
-		void fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, shader_t shader);
+		void fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, shader_t &&shader);
 	};
 
+	SWSL_ISA_END
+
 }
 
 template < int var, int cnst >
-void swsl::Rasterizer::FillTriangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, const mmlVector<cnst> &const_attr)
+void swsl::Rasterizer::FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, const mmlVector<cnst> &const_attr)
 {
-	// TODO
-	// 3) Perspective correction
-
-	// ISSUES
-	// Interpolated values seem to overflow at the edges
-
-	gfx_float varying_arr[var];
-	gfx_float constants_arr[cnst];
-	swsl::Shader::InputArrays shader_input = {
-		{ constants_arr, cnst },                // constant register
-		{ varying_arr, var },                   // varying register
-		{ NULL, m_out_buffer.GetPixelStride() } // fragment register
-	};
-	m_shader->SetInputArrays(shader_input);
-	if (!m_shader->IsValid()) { return; }
-
-	// Copy constant data to register
-	for (int i = 0; i < cnst; ++i) {
-		constants_arr[i] = const_attr[i];
-	}
-
-	// Pump data for X number of pixels into these
-	gfx_float a_reg[var];
-	gfx_float b_reg[var];
-	gfx_float c_reg[var];
+	float attr[var * 3 + cnst + 1];
 	for (int i = 0; i < var; ++i) {
-		a_reg[i] = a_attr[i];
-		b_reg[i] = b_attr[i];
-		c_reg[i] = c_attr[i];
+		attr[i]           = a_attr[i];
+		attr[var + i]     = b_attr[i];
+		attr[var * 2 + i] = c_attr[i];
 	}
+	for (int i = 0; i < cnst; ++i) {
+		attr[var * 3 + i] = const_attr[i];
+	}
+	FillTriangle(a, b, c, attr, var, cnst);
+}
 
-	// AABB Clipping
-	const int min_y = mmlMax(mmlMin(a.y, b.y, c.y), m_mask_y1);
-	const int max_y = mmlMin(mmlMax(a.y, b.y, c.y), m_mask_y2 - 1);
-	const int min_x = mmlMax(FloorIndex(mmlMin(a.x, b.x, c.x)), m_mask_x1); // Make sure this is snapped to a block boundry
-	const int max_x = mmlMin(mmlMax(a.x, b.x, c.x), m_mask_x2 - 1);
-
-	// Triangle setup
-	const gfx_float A01 = (float)((a.y - b.y) * MPL_WIDTH);
-	const gfx_float B01 = (float)(b.x - a.x);
-	const gfx_float A12 = (float)((b.y - c.y) * MPL_WIDTH);
-	const gfx_float B12 = (float)(c.x - b.x);
-	const gfx_float A20 = (float)((c.y - a.y) * MPL_WIDTH);
-	const gfx_float B20 = (float)(a.x - c.x);
-
-	const gfx_float bias0 = IsTopLeft(b, c) ? 0.0f : -1.0f;
-	const gfx_float bias1 = IsTopLeft(c, a) ? 0.0f : -1.0f;
-	const gfx_float bias2 = IsTopLeft(a, b) ? 0.0f : -1.0f;
-
-	const float x_offset[] = MPL_OFFSETS;
-	// float x_offset[] = MPL_X_OFFSETS;
-	// float y_offset[] = MPL_Y_OFFSETS;
-
-	wide_Point2D p = { gfx_float(min_x) + gfx_float(x_offset), min_y };
-	gfx_float w0_row = Orient2D(b, c, p) + bias0;
-	gfx_float w1_row = Orient2D(c, a, p) + bias1;
-	gfx_float w2_row = Orient2D(a, b, p) + bias2;
-	const gfx_float sum_inv_area_x2 = (gfx_float)(1.0f) / (w0_row + w1_row + w2_row);
-
-	gfx_float *pixel_offset = (gfx_float*)m_out_buffer.GetComponent(min_x / MPL_WIDTH, min_y, 0);
-	const int  pixel_y_stride = m_out_buffer.GetScanlineStride();
-
-	for (int y = min_y; y <= max_y; ++y) {
-
-		gfx_float w0 = w0_row;
-		gfx_float w1 = w1_row;
-		gfx_float w2 = w2_row;
-
-		shader_input.fragments.data = pixel_offset;
-		for (int x = min_x; x <= max_x; x += MPL_WIDTH) {
-
-			gfx_bool fragment_mask = (w0 | w1 | w2) >= 0.0f;
-
-			if (!fragment_mask.all_fail()) {
-
-				for (int i = 0; i < var; ++i) {
-					varying_arr[i] = (a_reg[i] * w0 + b_reg[i] * w1 + c_reg[i] * w2) * sum_inv_area_x2;
-				}
-
-				m_shader->Run(fragment_mask);
-			}
-
-			w0 += A12;
-			w1 += A20;
-			w2 += A01;
-
-			shader_input.fragments.data += shader_input.fragments.count;
-		}
+template < int var >
+void swsl::Rasterizer::FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr)
+{
+	mmlVector<0> const_attr;
+	FillTriangle(a, b, c, a_attr, b_attr, c_attr, const_attr);
+}
 
-		w0_row += B12;
-		w1_row += B20;
-		w2_row += B01;
+template < int cnst >
+void swsl::Rasterizer::FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const mmlVector<cnst> &const_attr)
+{
+	mmlVector<0> a_attr, b_attr, c_attr;
+	FillTriangle(a, b, c, a_attr, b_attr, c_attr, const_attr);
+}
 
-		pixel_offset += pixel_y_stride;
-	}
+// 2D triangles lie on the near plane without perspective
+template < int var, int cnst >
+void swsl::Rasterizer::FillTriangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, const mmlVector<cnst> &const_attr)
+{
+	const swsl::Point3D A = { a.x, a.y, 0.0f, 1.0f };
+	const swsl::Point3D B = { b.x, b.y, 0.0f, 1.0f };
+	const swsl::Point3D C = { c.x, c.y, 0.0f, 1.0f };
+	FillTriangle(A, B, C, a_attr, b_attr, c_attr, const_attr);
 }
 
 template < int var >
@@ -265,8 +344,9 @@ void swsl::Rasterizer::FillTriangle(const swsl::Point2D &a, const swsl::Point2D
 
 // Reference implementation for native rasterizer
 
-template < int var, int cnst, typename shader_t >
-void swsl::rasterizer::fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, const mmlVector<cnst> &const_attr, shader_t shader)
+// Tiles are handed out one at a time, so workers that draw cheap tiles go on to take more of them
+template < int var, int cnst, typename shader_t, typename worker_shader_t >
+void swsl::rasterizer::shade_tiles(fill_job<var, cnst, shader_t> &job, worker_shader_t &shader)
 {
 	gfx_float  arr[m_out_buffer.GetPixelStride() + var + cnst];
 	gfx_float *frag_arr = arr;
@@ -275,108 +355,156 @@ void swsl::rasterizer::fill_triangle(const swsl::Point2D &a, const swsl::Point2D
 
 	// Copy constant data to register
 	for (int i = 0; i < cnst; ++i) {
-		cnst_arr[i] = const_attr[i];
+		cnst_arr[i] = job.cnst_reg[i];
 	}
 
-	// Pump data for X number of pixels into these
-	gfx_float a_reg[var];
-	gfx_float b_reg[var];
-	gfx_float c_reg[var];
-	for (int i = 0; i < var; ++i) {
-		a_reg[i] = a_attr[i];
-		b_reg[i] = b_attr[i];
-		c_reg[i] = c_attr[i];
-	}
+	const int pixel_y_stride = m_out_buffer.GetScanlineStride();
+	const int pixel_x_stride = m_out_buffer.GetPixelStride();
 
-	// AABB Clipping
-	const int min_y = mmlMax(mmlMin(a.y, b.y, c.y), m_mask_y1);
-	const int max_y = mmlMin(mmlMax(a.y, b.y, c.y), m_mask_y2 - 1);
-	const int min_x = mmlMax(floor_index(mmlMin(a.x, b.x, c.x)), m_mask_x1); // Make sure this is snapped to a block boundry
-	const int max_x = mmlMin(mmlMax(a.x, b.x, c.x), m_mask_x2 - 1);
+	for (int tile = job.next_tile++; tile < job.tile_count; tile = job.next_tile++) {
 
-	// Triangle setup
-	const gfx_float A01 = (float)((a.y - b.y) * MPL_WIDTH);
-	const gfx_float B01 = (float)(b.x - a.x);
-	const gfx_float A12 = (float)((b.y - c.y) * MPL_WIDTH);
-	const gfx_float B12 = (float)(c.x - b.x);
-	const gfx_float A20 = (float)((c.y - a.y) * MPL_WIDTH);
-	const gfx_float B20 = (float)(a.x - c.x);
+		// Tiles are aligned to the screen, so clipped to the bounding box they still start on a block
+		const int x1 = mmlMax((job.tile_x + tile % job.tiles_x) * TILE_SIZE, job.min_x);
+		const int y1 = mmlMax((job.tile_y + tile / job.tiles_x) * TILE_SIZE, job.min_y);
+		const int x2 = mmlMin((job.tile_x + tile % job.tiles_x) * TILE_SIZE + TILE_SIZE - 1, job.max_x);
+		const int y2 = mmlMin((job.tile_y + tile / job.tiles_x) * TILE_SIZE + TILE_SIZE - 1, job.max_y);
 
-	const gfx_float bias0 = is_top_left(b, c) ? 0.0f : -1.0f;
-	const gfx_float bias1 = is_top_left(c, a) ? 0.0f : -1.0f;
-	const gfx_float bias2 = is_top_left(a, b) ? 0.0f : -1.0f;
+		// Edge functions hold whole numbers, so stepping to the tile gives the same values as walking to it
+		const gfx_float dx = (float)((x1 - job.min_x) / MPL_WIDTH);
+		const gfx_float dy = (float)(y1 - job.min_y);
+		gfx_float w0_row = job.w0 + job.A12 * dx + job.B12 * dy;
+		gfx_float w1_row = job.w1 + job.A20 * dx + job.B20 * dy;
+		gfx_float w2_row = job.w2 + job.A01 * dx + job.B01 * dy;
 
-	const float x_offset[] = MPL_OFFSETS;
-	// float x_offset[] = MPL_X_OFFSETS;
-	// float y_offset[] = MPL_Y_OFFSETS;
+		gfx_float *pixel_offset = (gfx_float*)m_out_buffer.GetComponent(x1 / MPL_WIDTH, y1, 0);
 
-	wide_Point2D p = { gfx_float(min_x) + gfx_float(x_offset), min_y };
-	gfx_float w0_row = orient_2d(b, c, p) + bias0;
-	gfx_float w1_row = orient_2d(c, a, p) + bias1;
-	gfx_float w2_row = orient_2d(a, b, p) + bias2;
-	const gfx_float sum_inv_area_x2 = (gfx_float)(1.0f) / (w0_row + w1_row + w2_row);
+		for (int y = y1; y <= y2; ++y) {
 
-	gfx_float *pixel_offset = (gfx_float*)m_out_buffer.GetComponent(min_x / MPL_WIDTH, min_y, 0);
-	const int  pixel_y_stride = m_out_buffer.GetScanlineStride();
-	const int  pixel_x_stride = m_out_buffer.GetPixelStride();
+			gfx_float w0 = w0_row;
+			gfx_float w1 = w1_row;
+			gfx_float w2 = w2_row;
 
-	for (int y = min_y; y <= max_y; ++y) {
+			gfx_float *pixel = pixel_offset;
+			for (int x = x1; x <= x2; x += MPL_WIDTH) {
 
-		gfx_float w0 = w0_row;
-		gfx_float w1 = w1_row;
-		gfx_float w2 = w2_row;
+				gfx_bool fragment_mask = (w0 >= 0.0f) & (w1 >= 0.0f) & (w2 >= 0.0f);
 
-		gfx_float *pixel = pixel_offset;
-		for (int x = min_x; x <= max_x; x += MPL_WIDTH) {
+				if (!fragment_mask.all_fail()) {
 
-			gfx_bool fragment_mask = (w0 | w1 | w2) >= 0.0f;
+					mtlCopy(frag_arr, pixel, pixel_x_stride);
+					for (int i = 0; i < var; ++i) {
+						var_arr[i] = (job.a_reg[i] * w0 + job.b_reg[i] * w1 + job.c_reg[i] * w2) * job.sum_inv_area_x2;
+					}
 
-			if (!fragment_mask.all_fail()) {
+					shader(arr, fragment_mask);
 
-				mtlCopy(frag_arr, pixel, pixel_x_stride);
-				for (int i = 0; i < var; ++i) {
-					var_arr[i] = (a_reg[i] * w0 + b_reg[i] * w1 + c_reg[i] * w2) * sum_inv_area_x2;
+					mtlCopy(pixel, frag_arr, pixel_x_stride);
 				}
 
-				shader(arr, fragment_mask);
+				w0 += job.A12;
+				w1 += job.A20;
+				w2 += job.A01;
 
-				mtlCopy(pixel, frag_arr, pixel_x_stride);
+				pixel += pixel_x_stride;
 			}
 
-			w0 += A12;
-			w1 += A20;
-			w2 += A01;
+			w0_row += job.B12;
+			w1_row += job.B20;
+			w2_row += job.B01;
 
-			pixel += pixel_x_stride;
+			pixel_offset += pixel_y_stride;
 		}
+	}
+}
 
-		w0_row += B12;
-		w1_row += B20;
-		w2_row += B01;
+template < int var, int cnst, typename shader_t >
+void swsl::rasterizer::fill_tiles(void *job, int)
+{
+	fill_job<var, cnst, shader_t> *j = (fill_job<var, cnst, shader_t>*)job;
+	if (j->r->m_pool.GetThreadCount() == 1) {
+		j->r->shade_tiles(*j, *j->shader);
+	} else {
+		typename std::decay<shader_t>::type shader(*j->shader);
+		j->r->shade_tiles(*j, shader);
+	}
+}
 
-		pixel_offset += pixel_y_stride;
+template < int var, int cnst, typename shader_t >
+void swsl::rasterizer::fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, const mmlVector<cnst> &const_attr, shader_t &&shader)
+{
+	typedef typename std::remove_reference<shader_t>::type shader_type;
+
+	fill_job<var, cnst, shader_type> job;
+	job.r      = this;
+	job.shader = &shader;
+
+	// Pump data for X number of pixels into these
+	for (int i = 0; i < var; ++i) {
+		job.a_reg[i] = a_attr[i];
+		job.b_reg[i] = b_attr[i];
+		job.c_reg[i] = c_attr[i];
+	}
+	for (int i = 0; i < cnst; ++i) {
+		job.cnst_reg[i] = const_attr[i];
 	}
+
+	// AABB Clipping
+	job.min_y = mmlMax(mmlMin(a.y, b.y, c.y), m_mask_y1);
+	job.max_y = mmlMin(mmlMax(a.y, b.y, c.y), m_mask_y2 - 1);
+	job.min_x = mmlMax(floor_index(mmlMin(a.x, b.x, c.x)), m_mask_x1); // Make sure this is snapped to a block boundry
+	job.max_x = mmlMin(mmlMax(a.x, b.x, c.x), m_mask_x2 - 1);
+	if (job.min_x > job.max_x || job.min_y > job.max_y) { return; }
+
+	// Triangle setup
+	job.A01 = (float)((a.y - b.y) * MPL_WIDTH);
+	job.B01 = (float)(b.x - a.x);
+	job.A12 = (float)((b.y - c.y) * MPL_WIDTH);
+	job.B12 = (float)(c.x - b.x);
+	job.A20 = (float)((c.y - a.y) * MPL_WIDTH);
+	job.B20 = (float)(a.x - c.x);
+
+	const gfx_float bias0 = is_top_left(b, c) ? 0.0f : -1.0f;
+	const gfx_float bias1 = is_top_left(c, a) ? 0.0f : -1.0f;
+	const gfx_float bias2 = is_top_left(a, b) ? 0.0f : -1.0f;
+
+	const float x_offset[] = MPL_OFFSETS;
+	// float x_offset[] = MPL_X_OFFSETS;
+	// float y_offset[] = MPL_Y_OFFSETS;
+
+	wide_Point2D p = { gfx_float(job.min_x) + gfx_float(x_offset), job.min_y };
+	job.w0 = orient_2d(b, c, p) + bias0;
+	job.w1 = orient_2d(c, a, p) + bias1;
+	job.w2 = orient_2d(a, b, p) + bias2;
+	job.sum_inv_area_x2 = (gfx_float)(1.0f) / (job.w0 + job.w1 + job.w2);
+
+	job.tile_x     = job.min_x / TILE_SIZE;
+	job.tile_y     = job.min_y / TILE_SIZE;
+	job.tiles_x    = job.max_x / TILE_SIZE - job.tile_x + 1;
+	job.tile_count = job.tiles_x * (job.max_y / TILE_SIZE - job.tile_y + 1);
+	job.next_tile  = 0;
+
+	m_pool.Run(fill_tiles<var, cnst, shader_type>, &job);
 }
 
 template < int var, typename shader_t >
-void swsl::rasterizer::fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, shader_t shader)
+void swsl::rasterizer::fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<var> &a_attr, const mmlVector<var> &b_attr, const mmlVector<var> &c_attr, shader_t &&shader)
 {
 	mmlVector<0> const_attr;
 	fill_triangle(a, b, c, a_attr, b_attr, c_attr, const_attr, shader);
 }
 
 template < int cnst, typename shader_t >
-void swsl::rasterizer::fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<cnst> &const_attr, shader_t shader)
+void swsl::rasterizer::fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, const mmlVector<cnst> &const_attr, shader_t &&shader)
 {
 	mmlVector<0> a_attr, b_attr, c_attr;
 	fill_triangle(a, b, c, a_attr, b_attr, c_attr, const_attr, shader);
 }
 
 template < typename shader_t >
-void swsl::rasterizer::fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, shader_t shader)
+void swsl::rasterizer::fill_triangle(const swsl::Point2D &a, const swsl::Point2D &b, const swsl::Point2D &c, shader_t &&shader)
 {
 	mmlVector<0> a_attr, b_attr, c_attr, const_attr;
-	FillTriangle(a, b, c, a_attr, b_attr, c_attr, const_attr, shader);
+	fill_triangle(a, b, c, a_attr, b_attr, c_attr, const_attr, shader);
 }
 
 #endif // SWSL_GFX_H_INCLUDED__
@@ -0,0 +1,248 @@
+#include <stdint.h>
+
+#include "swsl_image.h"
+#include "swsl_optimize.h"
+
+#include "MiniLib/MTL/mtlArray.h"
+#include "MiniLib/MTL/mtlMemory.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#define SWSL_IMAGE_MMAP 1
+#else
+	#include <fstream>
+	#define SWSL_IMAGE_MMAP 0
+#endif
+
+bool swsl::Image::IsSection(unsigned int offset, unsigned int count, unsigned int elem_size, int size)
+{
+	return
+		offset % gImage_Align == 0 &&
+		offset >= sizeof(ImageHeader) &&
+		offset <= (unsigned int)size &&
+		count <= ((unsigned int)size - offset) / elem_size;
+}
+
+unsigned int swsl::Image::Align(unsigned int offset)
+{
+	return (offset + gImage_Align - 1) & ~(unsigned int)(gImage_Align - 1);
+}
+
+// Validates the layout of the image. Program contents are verified when the image is given to a Shader.
+bool swsl::Image::Load(const void *data, int size)
+{
+	m_header = NULL;
+	if (data == NULL || size < (int)sizeof(ImageHeader) || ((uintptr_t)data) % sizeof(unsigned int) != 0) {
+		return false;
+	}
+	const ImageHeader *header = (const ImageHeader*)data;
+	if (
+		header->magic != gImage_Magic || header->version != gImage_Version || header->size != (unsigned int)size ||
+		!IsSection(header->entry_offset, header->entry_count, sizeof(ImageEntry), size) ||
+		!IsSection(header->code_offset, header->code_size, sizeof(Instruction), size) ||
+		!IsSection(header->pool_offset, header->pool_size, sizeof(float), size) ||
+		header->code_size < (unsigned int)gMetaData_Size || header->code_size > (unsigned int)(addr_t)(-1)
+	) {
+		return false;
+	}
+	const ImageEntry *entries = (const ImageEntry*)((const char*)data + header->entry_offset);
+	for (unsigned int i = 0; i < header->entry_count; ++i) {
+		if (entries[i].name[gImage_NameLen - 1] != 0 || entries[i].index >= header->code_size) { return false; }
+	}
+	m_header = header;
+	return true;
+}
+
+void swsl::Image::Unload( void )
+{
+	m_header = NULL;
+}
+
+bool swsl::Image::IsValid( void ) const
+{
+	return m_header != NULL;
+}
+
+const swsl::ImageHeader *swsl::Image::GetHeader( void ) const
+{
+	return m_header;
+}
+
+const swsl::ImageEntry *swsl::Image::GetEntries( void ) const
+{
+	return m_header != NULL ? (const ImageEntry*)((const char*)m_header + m_header->entry_offset) : NULL;
+}
+
+int swsl::Image::GetEntryCount( void ) const
+{
+	return m_header != NULL ? (int)m_header->entry_count : 0;
+}
+
+int swsl::Image::FindEntry(const mtlChars &name) const
+{
+	const ImageEntry *entries = GetEntries();
+	for (int i = 0; i < GetEntryCount(); ++i) {
+		int n = 0;
+		while (n < name.GetSize() && entries[i].name[n] == name[n]) { ++n; }
+		if (n == name.GetSize() && entries[i].name[n] == 0) { return i; }
+	}
+	return -1;
+}
+
+const swsl::Instruction *swsl::Image::GetCode( void ) const
+{
+	return m_header != NULL ? (const Instruction*)((const char*)m_header + m_header->code_offset) : NULL;
+}
+
+int swsl::Image::GetCodeSize( void ) const
+{
+	return m_header != NULL ? (int)m_header->code_size : 0;
+}
+
+const float *swsl::Image::GetPool( void ) const
+{
+	return m_header != NULL ? (const float*)((const char*)m_header + m_header->pool_offset) : NULL;
+}
+
+int swsl::Image::GetPoolSize( void ) const
+{
+	return m_header != NULL ? (int)m_header->pool_size : 0;
+}
+
+// 32-bit FNV-1a
+unsigned int swsl::Image::Hash(const mtlChars &source)
+{
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < source.GetSize(); ++i) {
+		h = (h ^ (unsigned char)source[i]) * 16777619u;
+	}
+	return h;
+}
+
+// The program is optimized before it is written so that loading the image does not have to.
+bool swsl::Image::Write(const Instruction *program, int size, int constants, int varyings, int fragments, unsigned int source_hash, Binary &out)
+{
+	out.Free();
+	if (size < gMetaData_Size) { return false; }
+
+	mtlArray<Instruction> code;
+	code.Create(size);
+	mtlCopy(&code[0], program, size);
+	Optimizer().Optimize(code);
+	size = code.GetSize();
+
+	// Deduplicate immediates into the pool
+	mtlArray<float> pool;
+	mtlArray<int>   pool_index;
+	pool.Create(size);
+	pool_index.Create(size);
+	int pool_size = 0;
+	for (int iptr = gMetaData_Size; iptr < size; ) {
+		const int instr = (int)code[iptr].instr;
+		if (instr < 0 || instr >= INSTR_COUNT || iptr + 1 + gInstr[instr].params > size) { return false; }
+		if (SWSL_INSTR_IMM_PARAM2(instr) || instr == FLT_MSET_MI) {
+			const float imm = code[iptr + 2].fl_imm;
+			int index = 0;
+			while (index < pool_size && !IsSameConstant(pool[index], imm)) { ++index; }
+			if (index == pool_size) { pool[pool_size++] = imm; }
+			pool_index[iptr + 2] = index;
+		}
+		iptr += 1 + gInstr[instr].params;
+	}
+
+	const unsigned int entry_offset = Align(sizeof(ImageHeader));
+	const unsigned int code_offset  = Align(entry_offset + sizeof(ImageEntry));
+	const unsigned int pool_offset  = Align(code_offset + size * sizeof(Instruction));
+	const unsigned int total        = pool_offset + pool_size * sizeof(float);
+
+	out.SetSize(total);
+	char *bytes = out.GetChars();
+	for (unsigned int i = 0; i < total; ++i) { bytes[i] = 0; } // padding and unused operand bits are deterministic
+
+	ImageHeader *header  = (ImageHeader*)bytes;
+	header->magic        = gImage_Magic;
+	header->version      = gImage_Version;
+	header->size         = total;
+	header->source_hash  = source_hash;
+	header->constants    = constants;
+	header->varyings     = varyings;
+	header->fragments    = fragments;
+	header->entry_count  = 1;
+	header->entry_offset = entry_offset;
+	header->code_size    = size;
+	header->code_offset  = code_offset;
+	header->pool_size    = pool_size;
+	header->pool_offset  = pool_offset;
+
+	ImageEntry *entry = (ImageEntry*)(bytes + entry_offset);
+	const char  main_name[] = "main";
+	mtlCopy(entry->name, main_name, sizeof(main_name));
+	entry->index = code[gMetaData_EntryIndex].u_addr;
+
+	Instruction *dst = (Instruction*)(bytes + code_offset);
+	for (int i = 0; i < gMetaData_Size; ++i) {
+		dst[i].u_addr = code[i].u_addr;
+	}
+	for (int iptr = gMetaData_Size; iptr < size; ) {
+		const InstructionSet instr = code[iptr].instr;
+		dst[iptr].instr = instr;
+		for (int p = 1; p <= gInstr[instr].params; ++p) {
+			dst[iptr + p].u_addr = (p == 2 && (SWSL_INSTR_IMM_PARAM2(instr) || instr == FLT_MSET_MI)) ? (addr_t)pool_index[iptr + p] : code[iptr + p].u_addr;
+		}
+		iptr += 1 + gInstr[instr].params;
+	}
+
+	float *dst_pool = (float*)(bytes + pool_offset);
+	for (int i = 0; i < pool_size; ++i) {
+		dst_pool[i] = pool[i];
+	}
+	return true;
+}
+
+bool swsl::ImageFile::Open(const mtlChars &file)
+{
+	Close();
+	mtlString path;
+	path.Copy(file);
+#if SWSL_IMAGE_MMAP
+	const int fd = open(path.GetChars(), O_RDONLY);
+	if (fd < 0) { return false; }
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) { return false; }
+	m_data = data;
+	m_size = (int)st.st_size;
+#else
+	std::ifstream fin(path.GetChars(), std::ios::binary | std::ios::ate);
+	if (!fin.is_open()) { return false; }
+	const int size = (int)fin.tellg();
+	if (size <= 0) { return false; }
+	float *data = new float[(size + sizeof(float) - 1) / sizeof(float)]; // aligned for in place reads
+	fin.seekg(0);
+	fin.read((char*)data, size);
+	m_data = data;
+	m_size = size;
+#endif
+	return true;
+}
+
+void swsl::ImageFile::Close( void )
+{
+	if (m_data != NULL) {
+#if SWSL_IMAGE_MMAP
+		munmap(m_data, m_size);
+#else
+		delete [] (float*)m_data;
+#endif
+	}
+	m_data = NULL;
+	m_size = 0;
+}
@@ -0,0 +1,95 @@
+#ifndef SWSL_IMAGE_H_INCLUDED__
+#define SWSL_IMAGE_H_INCLUDED__
+
+#include "MiniLib/MTL/mtlString.h"
+
+#include "swsl_instr.h"
+#include "swsl_shader.h"
+
+namespace swsl
+{
+
+const unsigned int gImage_Magic   = 0x4C535753; // "SWSL" when read little endian
+const unsigned int gImage_Version = 1;
+const int          gImage_Align   = 16;         // every section starts on this boundary
+const int          gImage_NameLen = 32;
+
+// On disk layout, all values are native endian and sections are addressed by byte offset from the header.
+// Immediate operands in the code section are indices into the constant pool.
+struct ImageHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int size;        // total bytes including header
+	unsigned int source_hash;
+	unsigned int constants;   // input layout
+	unsigned int varyings;
+	unsigned int fragments;
+	unsigned int entry_count;
+	unsigned int entry_offset;
+	unsigned int code_size;   // in instruction words, including meta data
+	unsigned int code_offset;
+	unsigned int pool_size;   // in floats
+	unsigned int pool_offset;
+};
+
+struct ImageEntry
+{
+	char         name[gImage_NameLen]; // null terminated
+	unsigned int index;                // instruction stream index
+};
+
+// A view of a compiled program image. Nothing is copied, the image is read in place,
+// so the memory passed to Load (typically a mapped file) must outlive the view.
+class Image
+{
+private:
+	const ImageHeader *m_header;
+
+private:
+	static bool         IsSection(unsigned int offset, unsigned int count, unsigned int elem_size, int size);
+	static unsigned int Align(unsigned int offset);
+
+public:
+	Image( void ) : m_header(NULL) {}
+
+	bool                Load(const void *data, int size);
+	void                Unload( void );
+	bool                IsValid( void ) const;
+	const ImageHeader  *GetHeader( void ) const;
+	const ImageEntry   *GetEntries( void ) const;
+	int                 GetEntryCount( void ) const;
+	int                 FindEntry(const mtlChars &name) const;
+	const Instruction  *GetCode( void ) const;
+	int                 GetCodeSize( void ) const;
+	const float        *GetPool( void ) const;
+	int                 GetPoolSize( void ) const;
+
+	static unsigned int Hash(const mtlChars &source);
+	static bool         Write(const Instruction *program, int size, int constants, int varyings, int fragments, unsigned int source_hash, Binary &out);
+};
+
+// Read only mapping of an image file
+class ImageFile
+{
+private:
+	void *m_data;
+	int   m_size;
+
+private:
+	ImageFile(const ImageFile&) {}
+	ImageFile &operator=(const ImageFile&) { return *this; }
+
+public:
+	ImageFile( void ) : m_data(NULL), m_size(0) {}
+	~ImageFile( void ) { Close(); }
+
+	bool        Open(const mtlChars &file);
+	void        Close( void );
+	const void *GetData( void ) const { return m_data; }
+	int         GetSize( void ) const { return m_size; }
+};
+
+}
+
+#endif // SWSL_IMAGE_H_INCLUDED__
@@ -12,6 +12,10 @@ namespace swsl {
 		// FIX, fixed operation
 		// FLT, float operation
 
+		// Operands of type M name a fixed slot in the frame (register file) of the program.
+		// Slot 0 is the first input. Operands of type I are immediate values.
+		// The first operand is the destination, MMM instructions take two sources after it.
+
 		NOP,
 		END,
 		RETURN,
@@ -25,18 +29,12 @@ namespace swsl {
 		TST_INV,
 
 
-		FLT_PUSH_M,
-		FLT_PUSH_I,
-		UNS_PUSH_I,
-
-		FLT_POP_M,
-		UNS_POP_I,
-
-
 		UNS_JMP_I,
+		TST_JMP_FAIL_I, // jump if all fragments in the block fail the conditional mask
+		TST_JMP_PASS_I, // jump if any fragment in the block passes the conditional mask
 
 
-		FLT_MSET_MM,
+		FLT_MSET_MM, // a = b for fragments passing the conditional mask
 		FLT_MSET_MI,
 
 
@@ -74,6 +72,97 @@ namespace swsl {
 		FLT_GTE_MM,
 		FLT_GTE_MI,
 
+
+		FLT_ADD_MMM,  // a = b + c
+		FLT_SUB_MMM,  // a = b - c
+		FLT_MUL_MMM,  // a = b * c
+		FLT_DIV_MMM,  // a = b / c
+		FLT_MAD_MMM,  // a = a * b + c
+		FLT_MSUB_MMM, // a = a * b - c
+		FLT_LERP_MMM, // a = a + (b - a) * c
+
+
+		// Integer and boolean values share the frame with floats, slots are reinterpreted by the instruction.
+		// Booleans are lane masks, the same representation as the test and mask registers.
+
+		TST_STORE_M, // a = test register
+		TST_LOAD_M,  // test register = a
+
+
+		INT_SET_MM,
+		INT_SET_MI,
+
+		INT_ADD_MM,
+		INT_ADD_MI,
+
+		INT_SUB_MM,
+		INT_SUB_MI,
+
+		INT_MUL_MM,
+		INT_MUL_MI,
+
+		INT_AND_MM,
+		INT_AND_MI,
+
+		INT_OR_MM,
+		INT_OR_MI,
+
+		INT_XOR_MM,
+		INT_XOR_MI,
+
+
+		INT_EQ_MM,
+		INT_EQ_MI,
+
+		INT_NEQ_MM,
+		INT_NEQ_MI,
+
+		INT_LT_MM,
+		INT_LT_MI,
+
+		INT_LTE_MM,
+		INT_LTE_MI,
+
+		INT_GT_MM,
+		INT_GT_MI,
+
+		INT_GTE_MM,
+		INT_GTE_MI,
+
+
+		INT_SHL_MC, // a <<= count, the count is a constant operand encoded as u_addr
+		INT_SHR_MC, // a >>= count, arithmetic shift
+		INT_NEG_MM, // a = -b
+		INT_NOT_MM, // a = ~b
+
+
+		BOOL_AND_MM, // a = a && b
+		BOOL_OR_MM,  // a = a || b
+		BOOL_XOR_MM, // a = a != b
+		BOOL_NOT_MM, // a = !b
+
+
+		INT_FLT_MM,  // a = (int)b, truncates
+		FLT_INT_MM,  // a = (float)b
+		INT_BOOL_MM, // a = b ? 1 : 0
+
+
+		// Intrinsics. Vector forms address three consecutive slots starting at the operand.
+
+		FLT_MIN_MM, // a = min(a, b)
+		FLT_MIN_MI,
+
+		FLT_MAX_MM, // a = max(a, b)
+		FLT_MAX_MI,
+
+		FLT_SQRT_MM,   // a = sqrt(b)
+		FLT_RSQRT_MM,  // a = 1 / sqrt(b)
+		FLT_ABS_MM,    // a = |b|
+		FLT_FLOOR_MM,  // a = floor(b), b must be in int range
+		FLT_CLAMP_MMM, // a = min(max(a, b), c)
+		FLT_DOT3_MMM,  // a = dot(b[0..2], c[0..2])
+		FLT_NORM3_MM,  // a[0..2] = b[0..2] / |b[0..2]|
+
 		INSTR_COUNT
 	};
 
@@ -96,13 +185,9 @@ namespace swsl {
 		{ mtlChars("tst_or"),      TST_OR,      0 },
 		{ mtlChars("tst_inv"),     TST_INV,     0 },
 
-		{ mtlChars("flt_push_m"),  FLT_PUSH_M,  1 },
-		{ mtlChars("flt_push_i"),  FLT_PUSH_I,  1 },
-		{ mtlChars("uns_push_i"),  UNS_PUSH_I,  1 },
-		{ mtlChars("flt_pop_m"),   FLT_POP_M,   1 },
-		{ mtlChars("uns_pop_i"),   UNS_POP_I,   1 },
-
-		{ mtlChars("uns_jmp_i"),   UNS_JMP_I,   1 },
+		{ mtlChars("uns_jmp_i"),      UNS_JMP_I,      1 },
+		{ mtlChars("tst_jmp_fail_i"), TST_JMP_FAIL_I, 1 },
+		{ mtlChars("tst_jmp_pass_i"), TST_JMP_PASS_I, 1 },
 
 		{ mtlChars("flt_mset_mm"), FLT_MSET_MM, 2 },
 		{ mtlChars("flt_mset_mi"), FLT_MSET_MI, 2 },
@@ -121,15 +206,80 @@ namespace swsl {
 		{ mtlChars("flt_eq_mm"),   FLT_EQ_MM,   2 },
 		{ mtlChars("flt_eq_mi"),   FLT_EQ_MI,   2 },
 		{ mtlChars("flt_neq_mm"),  FLT_NEQ_MM,  2 },
-		{ mtlChars("flt_neq_mi"),  FLT_NEQ_MM,  2 },
+		{ mtlChars("flt_neq_mi"),  FLT_NEQ_MI,  2 },
 		{ mtlChars("flt_lt_mm"),   FLT_LT_MM,   2 },
-		{ mtlChars("flt_lt_mi"),   FLT_LT_MM,   2 },
+		{ mtlChars("flt_lt_mi"),   FLT_LT_MI,   2 },
 		{ mtlChars("flt_lte_mm"),  FLT_LTE_MM,  2 },
-		{ mtlChars("flt_lte_mi"),  FLT_LTE_MM,  2 },
+		{ mtlChars("flt_lte_mi"),  FLT_LTE_MI,  2 },
 		{ mtlChars("flt_gt_mm"),   FLT_GT_MM,   2 },
-		{ mtlChars("flt_gt_mi"),   FLT_GT_MM,   2 },
+		{ mtlChars("flt_gt_mi"),   FLT_GT_MI,   2 },
 		{ mtlChars("flt_gte_mm"),  FLT_GTE_MM,  2 },
-		{ mtlChars("flt_gte_mi"),  FLT_GTE_MM,  2 }
+		{ mtlChars("flt_gte_mi"),  FLT_GTE_MI,  2 },
+
+		{ mtlChars("flt_add_mmm"),  FLT_ADD_MMM,  3 },
+		{ mtlChars("flt_sub_mmm"),  FLT_SUB_MMM,  3 },
+		{ mtlChars("flt_mul_mmm"),  FLT_MUL_MMM,  3 },
+		{ mtlChars("flt_div_mmm"),  FLT_DIV_MMM,  3 },
+		{ mtlChars("flt_mad_mmm"),  FLT_MAD_MMM,  3 },
+		{ mtlChars("flt_msub_mmm"), FLT_MSUB_MMM, 3 },
+		{ mtlChars("flt_lerp_mmm"), FLT_LERP_MMM, 3 },
+
+		{ mtlChars("tst_store_m"),  TST_STORE_M,  1 },
+		{ mtlChars("tst_load_m"),   TST_LOAD_M,   1 },
+
+		{ mtlChars("int_set_mm"),  INT_SET_MM,  2 },
+		{ mtlChars("int_set_mi"),  INT_SET_MI,  2 },
+		{ mtlChars("int_add_mm"),  INT_ADD_MM,  2 },
+		{ mtlChars("int_add_mi"),  INT_ADD_MI,  2 },
+		{ mtlChars("int_sub_mm"),  INT_SUB_MM,  2 },
+		{ mtlChars("int_sub_mi"),  INT_SUB_MI,  2 },
+		{ mtlChars("int_mul_mm"),  INT_MUL_MM,  2 },
+		{ mtlChars("int_mul_mi"),  INT_MUL_MI,  2 },
+		{ mtlChars("int_and_mm"),  INT_AND_MM,  2 },
+		{ mtlChars("int_and_mi"),  INT_AND_MI,  2 },
+		{ mtlChars("int_or_mm"),   INT_OR_MM,   2 },
+		{ mtlChars("int_or_mi"),   INT_OR_MI,   2 },
+		{ mtlChars("int_xor_mm"),  INT_XOR_MM,  2 },
+		{ mtlChars("int_xor_mi"),  INT_XOR_MI,  2 },
+
+		{ mtlChars("int_eq_mm"),   INT_EQ_MM,   2 },
+		{ mtlChars("int_eq_mi"),   INT_EQ_MI,   2 },
+		{ mtlChars("int_neq_mm"),  INT_NEQ_MM,  2 },
+		{ mtlChars("int_neq_mi"),  INT_NEQ_MI,  2 },
+		{ mtlChars("int_lt_mm"),   INT_LT_MM,   2 },
+		{ mtlChars("int_lt_mi"),   INT_LT_MI,   2 },
+		{ mtlChars("int_lte_mm"),  INT_LTE_MM,  2 },
+		{ mtlChars("int_lte_mi"),  INT_LTE_MI,  2 },
+		{ mtlChars("int_gt_mm"),   INT_GT_MM,   2 },
+		{ mtlChars("int_gt_mi"),   INT_GT_MI,   2 },
+		{ mtlChars("int_gte_mm"),  INT_GTE_MM,  2 },
+		{ mtlChars("int_gte_mi"),  INT_GTE_MI,  2 },
+
+		{ mtlChars("int_shl_mc"),  INT_SHL_MC,  2 },
+		{ mtlChars("int_shr_mc"),  INT_SHR_MC,  2 },
+		{ mtlChars("int_neg_mm"),  INT_NEG_MM,  2 },
+		{ mtlChars("int_not_mm"),  INT_NOT_MM,  2 },
+
+		{ mtlChars("bool_and_mm"), BOOL_AND_MM, 2 },
+		{ mtlChars("bool_or_mm"),  BOOL_OR_MM,  2 },
+		{ mtlChars("bool_xor_mm"), BOOL_XOR_MM, 2 },
+		{ mtlChars("bool_not_mm"), BOOL_NOT_MM, 2 },
+
+		{ mtlChars("int_flt_mm"),  INT_FLT_MM,  2 },
+		{ mtlChars("flt_int_mm"),  FLT_INT_MM,  2 },
+		{ mtlChars("int_bool_mm"), INT_BOOL_MM, 2 },
+
+		{ mtlChars("flt_min_mm"),    FLT_MIN_MM,    2 },
+		{ mtlChars("flt_min_mi"),    FLT_MIN_MI,    2 },
+		{ mtlChars("flt_max_mm"),    FLT_MAX_MM,    2 },
+		{ mtlChars("flt_max_mi"),    FLT_MAX_MI,    2 },
+		{ mtlChars("flt_sqrt_mm"),   FLT_SQRT_MM,   2 },
+		{ mtlChars("flt_rsqrt_mm"),  FLT_RSQRT_MM,  2 },
+		{ mtlChars("flt_abs_mm"),    FLT_ABS_MM,    2 },
+		{ mtlChars("flt_floor_mm"),  FLT_FLOOR_MM,  2 },
+		{ mtlChars("flt_clamp_mmm"), FLT_CLAMP_MMM, 3 },
+		{ mtlChars("flt_dot3_mmm"),  FLT_DOT3_MMM,  3 },
+		{ mtlChars("flt_norm3_mm"),  FLT_NORM3_MM,  2 }
 	};
 
 	typedef unsigned short addr_t;
@@ -138,14 +288,122 @@ namespace swsl {
 	{
 		InstructionSet instr;
 		float          fl_imm;
-		addr_t         u_addr;
+		int            in_imm; // shares the constant pool with fl_imm, entries are compared by representation
+		addr_t         u_addr; // absolute frame slot, instruction index or constant count
 	};
 
 	const int gMetaData_InputIndex = 0;
 	const int gMetaData_EntryIndex = 1;
+	const int gMetaData_StackIndex = 2; // frame slots plus saved masks, computed by the loader
+	const int gMetaData_Size       = 3;
+
+	// Is the single operand of the instruction an instruction index?
+	inline bool IsJump(InstructionSet instr)
+	{
+		return instr == UNS_JMP_I || instr == TST_JMP_FAIL_I || instr == TST_JMP_PASS_I;
+	}
+
+	// Is the second operand a constant count instead of a frame slot or immediate?
+	inline bool IsCountOperand(InstructionSet instr)
+	{
+		return instr == INT_SHL_MC || instr == INT_SHR_MC;
+	}
+
+	// Does the instruction read the previous value of its destination operand?
+	inline bool ReadsDestination(InstructionSet instr)
+	{
+		switch (instr) {
+		case TST_STORE_M:
+		case FLT_SET_MM:
+		case FLT_SET_MI:
+		case FLT_ADD_MMM:
+		case FLT_SUB_MMM:
+		case FLT_MUL_MMM:
+		case FLT_DIV_MMM:
+		case INT_SET_MM:
+		case INT_SET_MI:
+		case INT_NEG_MM:
+		case INT_NOT_MM:
+		case BOOL_NOT_MM:
+		case INT_FLT_MM:
+		case FLT_INT_MM:
+		case INT_BOOL_MM:
+		case FLT_SQRT_MM:
+		case FLT_RSQRT_MM:
+		case FLT_ABS_MM:
+		case FLT_FLOOR_MM:
+		case FLT_DOT3_MMM:
+		case FLT_NORM3_MM:
+			return false;
+		case TST_LOAD_M:
+			return true;
+		default: break;
+		}
+		return gInstr[instr].params >= 2;
+	}
+
+	// Does the instruction write to its destination operand? Comparisons only write the test register.
+	inline bool WritesDestination(InstructionSet instr)
+	{
+		switch (instr) {
+		case FLT_EQ_MM:
+		case FLT_EQ_MI:
+		case FLT_NEQ_MM:
+		case FLT_NEQ_MI:
+		case FLT_LT_MM:
+		case FLT_LT_MI:
+		case FLT_LTE_MM:
+		case FLT_LTE_MI:
+		case FLT_GT_MM:
+		case FLT_GT_MI:
+		case FLT_GTE_MM:
+		case FLT_GTE_MI:
+		case INT_EQ_MM:
+		case INT_EQ_MI:
+		case INT_NEQ_MM:
+		case INT_NEQ_MI:
+		case INT_LT_MM:
+		case INT_LT_MI:
+		case INT_LTE_MM:
+		case INT_LTE_MI:
+		case INT_GT_MM:
+		case INT_GT_MI:
+		case INT_GTE_MM:
+		case INT_GTE_MI:
+		case TST_LOAD_M:
+			return false;
+		case TST_STORE_M:
+			return true;
+		default: break;
+		}
+		return gInstr[instr].params >= 2;
+	}
+
+	// Number of consecutive slots addressed by an operand, 0 is the destination
+	inline int OperandSlots(InstructionSet instr, int param)
+	{
+		switch (instr) {
+		case FLT_DOT3_MMM: return param > 0 ? 3 : 1;
+		case FLT_NORM3_MM: return 3;
+		default: break;
+		}
+		return 1;
+	}
+
+	// Immediates are compared by representation so that 0 and -0 stay distinct
+	inline bool IsSameConstant(float a, float b)
+	{
+		union { float f; unsigned int u; } x, y;
+		x.f = a;
+		y.f = b;
+		return x.u == y.u;
+	}
 
 }
 
-#define SWSL_INSTR_IMM_PARAM2(X) ((X) >= swsl::FLT_SET_MM && (X & 1) != (swsl::FLT_SET_MM & 1))
+#define SWSL_INSTR_IMM_PARAM2(X) \
+	(((X) >= swsl::FLT_SET_MM && (X) <= swsl::FLT_GTE_MI && ((X) & 1) != (swsl::FLT_SET_MM & 1)) || \
+	 ((X) >= swsl::INT_SET_MM && (X) <= swsl::INT_GTE_MI && ((X) & 1) != (swsl::INT_SET_MM & 1)) || \
+	 ((X) >= swsl::FLT_MIN_MM && (X) <= swsl::FLT_MAX_MI && ((X) & 1) != (swsl::FLT_MIN_MM & 1)))
 
 #endif // INSTR_H
@@ -0,0 +1,80 @@
+#include "swsl_isa.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	#define SWSL_ISA_CPUID 1
+#else
+	#define SWSL_ISA_CPUID 0
+#endif
+
+// Constant initialized, so builds can register from static initializers in any order
+static swsl::RendererFactory gRenderers[swsl::ISA_COUNT] = { NULL, NULL, NULL };
+
+const char *swsl::GetIsaName(swsl::Isa isa)
+{
+	switch (isa) {
+	case ISA_SSE:    return "sse";
+	case ISA_AVX2:   return "avx2";
+	case ISA_AVX512: return "avx512";
+	default: break;
+	}
+	return "";
+}
+
+// Also checks that the operating system saves the extended registers
+bool swsl::IsIsaSupported(swsl::Isa isa)
+{
+#if SWSL_ISA_CPUID
+	__builtin_cpu_init();
+	switch (isa) {
+	case ISA_SSE:    return true;
+	case ISA_AVX2:   return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case ISA_AVX512: return __builtin_cpu_supports("avx512f");
+	default: break;
+	}
+	return false;
+#else
+	return isa == ISA_SSE;
+#endif
+}
+
+// The widest build the CPU supports, unless overridden by setting SWSL_ISA to the name of a build.
+// Only builds that registered a renderer are considered.
+swsl::Isa swsl::SelectIsa( void )
+{
+	const char *name = getenv("SWSL_ISA");
+	if (name != NULL) {
+		for (int i = 0; i < ISA_COUNT; ++i) {
+			if (strcmp(name, GetIsaName((Isa)i)) == 0 && gRenderers[i] != NULL && IsIsaSupported((Isa)i)) {
+				return (Isa)i;
+			}
+		}
+	}
+	for (int i = ISA_COUNT - 1; i > ISA_SSE; --i) {
+		if (gRenderers[i] != NULL && IsIsaSupported((Isa)i)) {
+			return (Isa)i;
+		}
+	}
+	return ISA_SSE;
+}
+
+bool swsl::RegisterRenderer(swsl::Isa isa, swsl::RendererFactory factory)
+{
+	if (isa < 0 || isa >= ISA_COUNT) { return false; }
+	gRenderers[isa] = factory;
+	return true;
+}
+
+// NULL if the build was not linked in or the CPU does not support it. Delete the renderer when done.
+swsl::Renderer *swsl::CreateRenderer(swsl::Isa isa)
+{
+	if (isa < 0 || isa >= ISA_COUNT || gRenderers[isa] == NULL || !IsIsaSupported(isa)) { return NULL; }
+	return gRenderers[isa]();
+}
+
+swsl::Renderer *swsl::CreateRenderer( void )
+{
+	return CreateRenderer(SelectIsa());
+}
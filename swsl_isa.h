@@ -0,0 +1,51 @@
+#ifndef SWSL_ISA_H_INCLUDED__
+#define SWSL_ISA_H_INCLUDED__
+
+// Code that depends on the SIMD width (the VM, the rasterizers and the frame buffers) can be compiled
+// once per instruction set and linked into the same binary, see SWSL.pro. Every build but the baseline
+// defines one of SWSL_ISA_AVX2 or SWSL_ISA_AVX512 and renames the mpl namespace. Its classes are placed
+// in an inline namespace of their own, so the builds do not collide while code keeps referring to them
+// as swsl::Shader and so on. The application only uses the baseline build directly and reaches the
+// others through swsl::Renderer, which each build registers for its instruction set.
+#if defined(SWSL_ISA_AVX512)
+	#define SWSL_ISA           swsl::ISA_AVX512
+	#define SWSL_ISA_NAMESPACE isa_avx512
+	#define SWSL_ISA_BASELINE  0
+#elif defined(SWSL_ISA_AVX2)
+	#define SWSL_ISA           swsl::ISA_AVX2
+	#define SWSL_ISA_NAMESPACE isa_avx2
+	#define SWSL_ISA_BASELINE  0
+#else
+	#define SWSL_ISA           swsl::ISA_SSE
+	#define SWSL_ISA_NAMESPACE isa_sse
+	#define SWSL_ISA_BASELINE  1
+#endif
+
+#define SWSL_ISA_BEGIN inline namespace SWSL_ISA_NAMESPACE {
+#define SWSL_ISA_END   }
+
+namespace swsl
+{
+
+class Renderer;
+
+enum Isa
+{
+	ISA_SSE,    // baseline, whatever the compiler targets by default
+	ISA_AVX2,
+	ISA_AVX512,
+	ISA_COUNT
+};
+
+typedef Renderer *(*RendererFactory)( void );
+
+const char *GetIsaName(Isa isa);
+bool        IsIsaSupported(Isa isa);
+Isa         SelectIsa( void );
+bool        RegisterRenderer(Isa isa, RendererFactory factory);
+Renderer   *CreateRenderer(Isa isa);
+Renderer   *CreateRenderer( void );
+
+}
+
+#endif // SWSL_ISA_H_INCLUDED__
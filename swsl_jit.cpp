@@ -0,0 +1,412 @@
+#include "swsl_jit.h"
+#include "swsl_shader.h"
+#include "swsl_instr.h"
+
+#include "MiniLib/MTL/mtlMemory.h"
+
+#if SWSL_JIT
+	#include <sys/mman.h>
+#endif
+
+// Register assignment of the generated code (System V calling convention, everything used is caller saved).
+//   rdi   base register array, loaded into r8-r11 in swsl::Shader::Segment order
+//   rsi   constant pool
+//   rdx   mask stack
+//   rcx   coverage mask of the block
+//   xmm0  scratch, xmm1 scratch
+//   xmm2  - xmm12 local slots
+//   xmm13 all bits set
+//   xmm14 test register
+//   xmm15 mask register
+#define JIT_RAX         0
+#define JIT_RCX         1
+#define JIT_RDX         2
+#define JIT_RSI         6
+#define JIT_R8          8
+#define JIT_XMM_LOCAL   2
+#define JIT_XMM_LOCALS  11
+#define JIT_XMM_ONES    13
+#define JIT_XMM_TEST    14
+#define JIT_XMM_MASK    15
+#define JIT_OP_BYTES    64 // upper bound of generated bytes per instruction
+
+// SSE opcodes following the 0x0F escape
+#define SSE_MOVUPS_LOAD  0x10
+#define SSE_MOVUPS_STORE 0x11
+#define SSE_MOVAPS       0x28
+#define SSE_MOVMSKPS     0x50
+#define SSE_ANDPS        0x54
+#define SSE_ANDNPS       0x55
+#define SSE_ORPS         0x56
+#define SSE_XORPS        0x57
+#define SSE_ADDPS        0x58
+#define SSE_MULPS        0x59
+#define SSE_SUBPS        0x5C
+#define SSE_DIVPS        0x5E
+#define SSE_PCMPEQD      0x76
+#define SSE_CMPPS        0xC2
+
+// cmpps predicates
+#define CMP_EQ  0
+#define CMP_LT  1
+#define CMP_LE  2
+#define CMP_NEQ 4
+
+bool swsl::JitCode::Create(const unsigned char *code, int size)
+{
+	Free();
+#if SWSL_JIT
+	if (sizeof(mpl::wide_float) != 16 || sizeof(mpl::wide_bool) != 16 || size <= 0) { return false; }
+	void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) { return false; }
+	mtlCopy((unsigned char*)memory, code, size);
+	// Never writable and executable at the same time
+	if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(memory, size);
+		return false;
+	}
+	m_memory   = memory;
+	m_size     = size;
+	m_function = reinterpret_cast<Function>(memory);
+	return true;
+#else
+	(void)code;
+	return false;
+#endif
+}
+
+void swsl::JitCode::Free( void )
+{
+#if SWSL_JIT
+	if (m_memory != NULL) {
+		munmap(m_memory, m_size);
+	}
+#endif
+	m_memory   = NULL;
+	m_size     = 0;
+	m_function = NULL;
+}
+
+void swsl::JitCompiler::Byte(int b)
+{
+	m_out[m_size++] = (unsigned char)b;
+}
+
+void swsl::JitCompiler::Int32(int i)
+{
+	const unsigned int u = (unsigned int)i;
+	Byte(u & 0xff);
+	Byte((u >> 8) & 0xff);
+	Byte((u >> 16) & 0xff);
+	Byte((u >> 24) & 0xff);
+}
+
+void swsl::JitCompiler::Rex(int reg, int rm_base, bool force)
+{
+	const int rex = 0x40 | (((reg >> 3) & 1) << 2) | ((rm_base >> 3) & 1);
+	if (rex != 0x40 || force) { Byte(rex); }
+}
+
+// Emits [prefix] [REX] 0F opcode ModRM [disp]. Base registers are never rsp or r12, so no SIB byte is needed.
+void swsl::JitCompiler::RegMem(int prefix, int opcode, int reg, const Location &rm)
+{
+	if (prefix != 0) { Byte(prefix); }
+	Rex(reg, rm.is_reg ? rm.reg : rm.base, false);
+	Byte(0x0F);
+	Byte(opcode);
+	if (rm.is_reg) {
+		Byte(0xC0 | ((reg & 7) << 3) | (rm.reg & 7));
+	} else if (rm.disp >= -128 && rm.disp <= 127) {
+		Byte(0x40 | ((reg & 7) << 3) | (rm.base & 7));
+		Byte(rm.disp & 0xff);
+	} else {
+		Byte(0x80 | ((reg & 7) << 3) | (rm.base & 7));
+		Int32(rm.disp);
+	}
+}
+
+void swsl::JitCompiler::Move(int xmm, const Location &src)
+{
+	if (!src.is_reg) {
+		RegMem(0, SSE_MOVUPS_LOAD, xmm, src);
+	} else if (src.reg != xmm) {
+		RegMem(0, SSE_MOVAPS, xmm, src);
+	}
+}
+
+void swsl::JitCompiler::Move(const Location &dst, int xmm)
+{
+	if (!dst.is_reg) {
+		RegMem(0, SSE_MOVUPS_STORE, xmm, dst);
+	} else if (dst.reg != xmm) {
+		RegMem(0, SSE_MOVAPS, dst.reg, Reg(xmm));
+	}
+}
+
+swsl::JitCompiler::Location swsl::JitCompiler::Reg(int xmm) const
+{
+	Location l = { xmm, 0, 0, true };
+	return l;
+}
+
+swsl::JitCompiler::Location swsl::JitCompiler::Slot(int seg, int offset) const
+{
+	if (seg == Shader::SEG_LOCAL && m_local_reg[offset] >= 0) {
+		return Reg(m_local_reg[offset]);
+	}
+	Location l = { 0, JIT_R8 + seg, offset * (int)sizeof(mpl::wide_float), false };
+	return l;
+}
+
+swsl::JitCompiler::Location swsl::JitCompiler::Constant(int index) const
+{
+	Location l = { 0, JIT_RSI, index * (int)sizeof(mpl::wide_float), false };
+	return l;
+}
+
+// Emits a jump with an unresolved rel32 and returns the offset of the rel32 field
+int swsl::JitCompiler::Jump(int opcode)
+{
+	if (opcode != 0xE9) { Byte(0x0F); }
+	Byte(opcode);
+	const int at = m_size;
+	Int32(0);
+	return at;
+}
+
+bool swsl::JitCompiler::Compile(const Shader &shader, JitCode &out)
+{
+	out.Free();
+#if SWSL_JIT
+	const int         count = shader.m_code.GetSize() - 1; // excluding the terminating instruction
+	const Shader::Op *code  = &shader.m_code[0];
+	if (count < 0) { return false; }
+
+	// The most referenced local slots are assigned to registers
+	const int locals = shader.m_segment_size[Shader::SEG_LOCAL];
+	mtlArray<int> uses;
+	uses.Create(locals + 1);
+	m_local_reg.Create(locals + 1);
+	for (int i = 0; i <= locals; ++i) {
+		uses[i]        = 0;
+		m_local_reg[i] = -1;
+	}
+	for (int i = 0; i < count; ++i) {
+		const Shader::Op &op = code[i];
+		const int params = gInstr[op.instr].params;
+		if (op.depth == Shader::MASK_UNREACHABLE || IsJump(op.instr) || params < 2) { continue; }
+		if (op.seg_a == Shader::SEG_LOCAL) { ++uses[op.a]; }
+		if (!SWSL_INSTR_IMM_PARAM2(op.instr) && op.instr != FLT_MSET_MI && op.seg_b == Shader::SEG_LOCAL) { ++uses[op.b]; }
+		if (params == 3 && op.seg_c == Shader::SEG_LOCAL) { ++uses[op.c]; }
+	}
+	for (int r = 0; r < JIT_XMM_LOCALS; ++r) {
+		int best = -1;
+		for (int i = 0; i < locals; ++i) {
+			if (m_local_reg[i] < 0 && uses[i] > 0 && (best < 0 || uses[i] > uses[best])) { best = i; }
+		}
+		if (best < 0) { break; }
+		m_local_reg[best] = JIT_XMM_LOCAL + r;
+	}
+
+	m_out.Create((count + 2) * JIT_OP_BYTES);
+	m_size = 0;
+
+	mtlArray<int>   label;
+	mtlArray<Fixup> fixups;
+	label.Create(count + 1);
+	fixups.Create(count + 1);
+	int fixup_count = 0;
+
+	// Prologue: load base registers, mask register is all set
+	for (int s = 0; s < Shader::SEG_COUNT; ++s) {
+		Byte(0x4C); // REX.W REX.R, mov r8+s, [rdi + s*8]
+		Byte(0x8B);
+		Byte(0x47 | (s << 3));
+		Byte(s * (int)sizeof(void*));
+	}
+	RegMem(0x66, SSE_PCMPEQD, JIT_XMM_MASK, Reg(JIT_XMM_MASK));
+	Move(JIT_XMM_ONES, Reg(JIT_XMM_MASK));
+	if (shader.m_entry != 0) {
+		fixups[fixup_count].at       = Jump(0xE9);
+		fixups[fixup_count++].target = shader.m_entry;
+	}
+
+	for (int i = 0; i <= count; ++i) {
+		const Shader::Op &op = code[i];
+		label[i] = m_size;
+		if (op.depth == Shader::MASK_UNREACHABLE) { continue; }
+
+		const InstructionSet  instr = op.instr;
+		const bool            imm   = SWSL_INSTR_IMM_PARAM2(instr) || instr == FLT_MSET_MI;
+		const Location        a     = Slot(op.seg_a, op.a);
+		const Location        b     = imm ? Constant(op.b) : Slot(op.seg_b, op.b);
+		const Location        c     = Slot(op.seg_c, op.c);
+		const int             t     = a.is_reg ? a.reg : 0; // register holding the destination while it is computed
+
+		int opcode = 0, pred = 0;
+		switch (instr) {
+		case FLT_ADD_MM: case FLT_ADD_MI: case FLT_ADD_MMM: case FLT_MAD_MMM:  opcode = SSE_ADDPS; break;
+		case FLT_SUB_MM: case FLT_SUB_MI: case FLT_SUB_MMM: case FLT_MSUB_MMM: opcode = SSE_SUBPS; break;
+		case FLT_MUL_MM: case FLT_MUL_MI: case FLT_MUL_MMM:                    opcode = SSE_MULPS; break;
+		case FLT_DIV_MM: case FLT_DIV_MI: case FLT_DIV_MMM:                    opcode = SSE_DIVPS; break;
+		case FLT_EQ_MM:  case FLT_EQ_MI:                                       pred = CMP_EQ;  break;
+		case FLT_NEQ_MM: case FLT_NEQ_MI:                                      pred = CMP_NEQ; break;
+		case FLT_LT_MM:  case FLT_LT_MI:  case FLT_GT_MM:  case FLT_GT_MI:     pred = CMP_LT;  break;
+		case FLT_LTE_MM: case FLT_LTE_MI: case FLT_GTE_MM: case FLT_GTE_MI:    pred = CMP_LE;  break;
+		default: break;
+		}
+
+		switch (instr) {
+		case NOP:
+			break;
+
+		case END:
+		case RETURN:
+			Byte(0xB8); // mov eax, 1
+			Int32(1);
+			Byte(0xC3); // ret
+			break;
+
+		case INSTR_COUNT:
+			Byte(0x31); // xor eax, eax
+			Byte(0xC0);
+			Byte(0xC3); // ret
+			break;
+
+		case TST_PUSH: {
+			const Location l = { 0, JIT_RDX, op.depth * (int)sizeof(mpl::wide_bool), false };
+			Move(l, JIT_XMM_MASK);
+			break;
+		}
+
+		case TST_POP: {
+			const Location l = { 0, JIT_RDX, (op.depth - 1) * (int)sizeof(mpl::wide_bool), false };
+			Move(JIT_XMM_MASK, l);
+			break;
+		}
+
+		case TST_AND:
+			RegMem(0, SSE_ANDPS, JIT_XMM_MASK, Reg(JIT_XMM_TEST));
+			break;
+
+		case TST_OR:
+			RegMem(0, SSE_ORPS, JIT_XMM_MASK, Reg(JIT_XMM_TEST));
+			break;
+
+		case TST_INV:
+			RegMem(0, SSE_XORPS, JIT_XMM_MASK, Reg(JIT_XMM_ONES));
+			break;
+
+		case UNS_JMP_I:
+			fixups[fixup_count].at       = Jump(0xE9);
+			fixups[fixup_count++].target = op.b;
+			break;
+
+		// Fragments outside the block coverage do not keep a branch alive
+		case TST_JMP_FAIL_I:
+		case TST_JMP_PASS_I: {
+			const Location coverage = { 0, JIT_RCX, 0, false };
+			Move(0, Reg(JIT_XMM_MASK));
+			RegMem(0, SSE_ANDPS, 0, coverage);
+			RegMem(0, SSE_MOVMSKPS, JIT_RAX, Reg(0));
+			Byte(0x85); // test eax, eax
+			Byte(0xC0);
+			fixups[fixup_count].at       = Jump(instr == TST_JMP_FAIL_I ? 0x84 : 0x85); // je, jne
+			fixups[fixup_count++].target = op.b;
+			break;
+		}
+
+		case FLT_MSET_MM:
+		case FLT_MSET_MI:
+			Move(0, b);
+			RegMem(0, SSE_ANDPS, 0, Reg(JIT_XMM_MASK));
+			Move(1, Reg(JIT_XMM_MASK));
+			RegMem(0, SSE_ANDNPS, 1, a);
+			RegMem(0, SSE_ORPS, 0, Reg(1));
+			Move(a, 0);
+			break;
+
+		case FLT_SET_MM:
+		case FLT_SET_MI:
+			Move(t, b);
+			Move(a, t);
+			break;
+
+		case FLT_ADD_MM: case FLT_ADD_MI:
+		case FLT_SUB_MM: case FLT_SUB_MI:
+		case FLT_MUL_MM: case FLT_MUL_MI:
+		case FLT_DIV_MM: case FLT_DIV_MI:
+			Move(t, a);
+			RegMem(0, opcode, t, b);
+			Move(a, t);
+			break;
+
+		case FLT_EQ_MM:  case FLT_EQ_MI:
+		case FLT_NEQ_MM: case FLT_NEQ_MI:
+		case FLT_LT_MM:  case FLT_LT_MI:
+		case FLT_LTE_MM: case FLT_LTE_MI:
+			Move(JIT_XMM_TEST, a);
+			RegMem(0, SSE_CMPPS, JIT_XMM_TEST, b);
+			Byte(pred);
+			break;
+
+		// a > b is computed as b < a
+		case FLT_GT_MM:  case FLT_GT_MI:
+		case FLT_GTE_MM: case FLT_GTE_MI:
+			Move(JIT_XMM_TEST, b);
+			RegMem(0, SSE_CMPPS, JIT_XMM_TEST, a);
+			Byte(pred);
+			break;
+
+		case FLT_ADD_MMM:
+		case FLT_SUB_MMM:
+		case FLT_MUL_MMM:
+		case FLT_DIV_MMM: {
+			const int r = (c.is_reg && c.reg == t) ? 0 : t; // loading b must not overwrite c
+			Move(r, b);
+			RegMem(0, opcode, r, c);
+			Move(a, r);
+			break;
+		}
+
+		case FLT_MAD_MMM:
+		case FLT_MSUB_MMM: {
+			const int r = (c.is_reg && c.reg == t) ? 0 : t; // the product must not overwrite c
+			Move(r, a);
+			RegMem(0, SSE_MULPS, r, b);
+			RegMem(0, opcode, r, c);
+			Move(a, r);
+			break;
+		}
+
+		case FLT_LERP_MMM:
+			Move(1, b);
+			RegMem(0, SSE_SUBPS, 1, a);
+			RegMem(0, SSE_MULPS, 1, c);
+			Move(t, a);
+			RegMem(0, SSE_ADDPS, t, Reg(1));
+			Move(a, t);
+			break;
+
+		default:
+			m_out.Free();
+			return false;
+		}
+	}
+
+	for (int i = 0; i < fixup_count; ++i) {
+		const int rel = label[fixups[i].target] - (fixups[i].at + 4);
+		const int end = m_size;
+		m_size = fixups[i].at;
+		Int32(rel);
+		m_size = end;
+	}
+
+	const bool result = out.Create(&m_out[0], m_size);
+	m_out.Free();
+	return result;
+#else
+	(void)shader;
+	return false;
+#endif
+}
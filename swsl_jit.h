@@ -0,0 +1,94 @@
+#ifndef SWSL_JIT_H_INCLUDED__
+#define SWSL_JIT_H_INCLUDED__
+
+#include "MiniLib/MPL/mplWide.h"
+#include "MiniLib/MTL/mtlArray.h"
+
+#include "swsl_isa.h"
+
+// Native code generation is only implemented for SSE on x86-64 Linux
+#if defined(__x86_64__) && defined(__linux__) && MPL_WIDTH == 4
+	#define SWSL_JIT 1
+#else
+	#define SWSL_JIT 0
+#endif
+
+namespace swsl
+{
+SWSL_ISA_BEGIN
+
+class Shader;
+
+// Executable memory holding a compiled program. Runs one block of fragments per call.
+// Returns 1 when the program ends normally, 0 if it ran off the end of the stream.
+class JitCode
+{
+public:
+	typedef int (*Function)(mpl::wide_float *const *base, const mpl::wide_float *pool, mpl::wide_bool *mask_stack, const mpl::wide_bool *coverage);
+
+private:
+	void     *m_memory;
+	int       m_size;
+	Function  m_function;
+
+private:
+	JitCode(const JitCode&) {}
+	JitCode &operator=(const JitCode&) { return *this; }
+
+public:
+	JitCode( void ) : m_memory(NULL), m_size(0), m_function(NULL) {}
+	~JitCode( void ) { Free(); }
+
+	bool     Create(const unsigned char *code, int size);
+	void     Free( void );
+	bool     IsValid( void ) const { return m_function != NULL; }
+	Function GetFunction( void ) const { return m_function; }
+};
+
+// Translates the decoded program of a shader to native code.
+// Local slots are kept in vector registers, the most used ones first, the rest are spilled to the frame.
+// Relies on the mask stack depths resolved by Shader::Verify. Programs containing instructions the
+// generator does not support are rejected and left to the interpreter.
+class JitCompiler
+{
+private:
+	// Where an operand lives, either a vector register or [base + disp]
+	struct Location
+	{
+		int  reg;
+		int  base;
+		int  disp;
+		bool is_reg;
+	};
+
+	struct Fixup
+	{
+		int at;     // offset of rel32 field
+		int target; // decoded instruction index
+	};
+
+private:
+	mtlArray<unsigned char> m_out;
+	int                     m_size;
+	mtlArray<int>           m_local_reg; // vector register per local slot, -1 if spilled
+
+private:
+	void     Byte(int b);
+	void     Int32(int i);
+	void     Rex(int reg, int rm_base, bool force);
+	void     RegMem(int prefix, int opcode, int reg, const Location &rm);
+	void     Move(int xmm, const Location &src);
+	void     Move(const Location &dst, int xmm);
+	Location Reg(int xmm) const;
+	Location Slot(int seg, int offset) const;
+	Location Constant(int index) const;
+	int      Jump(int opcode2);
+
+public:
+	bool Compile(const Shader &shader, JitCode &out);
+};
+
+SWSL_ISA_END
+}
+
+#endif // SWSL_JIT_H_INCLUDED__
@@ -30,6 +30,31 @@ wide_t sqrt(const wide_t &a, const mpl::wide_bool&)
 	return wide_t::sqrt(a);
 }
 
+template < typename wide_t >
+wide_t rsqrt(const wide_t &a, const mpl::wide_bool&)
+{
+	return wide_t(1.0f) / wide_t::sqrt(a);
+}
+
+template < typename wide_t >
+wide_t abs(const wide_t &a, const mpl::wide_bool&)
+{
+	return wide_t::max(a, -a);
+}
+
+template < typename wide_t >
+wide_t clamp(const wide_t &a, const wide_t &lo, const wide_t &hi, const mpl::wide_bool&)
+{
+	return wide_t::min(wide_t::max(a, lo), hi);
+}
+
+// Same rounding as the VM, values must be in int range
+inline mpl::wide_float floor(const mpl::wide_float &a, const mpl::wide_bool&)
+{
+	const mpl::wide_float t = mpl::wide_float(mpl::wide_int(a));
+	return mpl::wide_float::mov_if_true(t, t - mpl::wide_float(1.0f), t > a);
+}
+
 }
 
 #endif // SWSL_MATH_H_INCLUDED__
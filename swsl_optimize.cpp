@@ -0,0 +1,934 @@
+#include "swsl_optimize.h"
+
+#include "MiniLib/MML/mmlMath.h"
+
+bool swsl::Optimizer::Load(const mtlArray<Instruction> &program)
+{
+	const int size = program.GetSize();
+	if (size < gMetaData_Size) { return false; }
+	for (int i = 0; i < gMetaData_Size; ++i) {
+		m_header[i] = program[i];
+	}
+
+	// Map instruction stream indices to node indices
+	mtlArray<int> node_index;
+	node_index.Create(size);
+	int count = 0;
+	for (int i = 0; i < size; ++i) { node_index[i] = -1; }
+	for (int iptr = gMetaData_Size; iptr < size; ) {
+		const int instr = (int)program[iptr].instr;
+		if (instr < 0 || instr >= INSTR_COUNT) { return false; }
+		node_index[iptr] = count++;
+		iptr += 1 + gInstr[instr].params;
+		if (iptr > size) { return false; }
+	}
+
+	const int entry = program[gMetaData_EntryIndex].u_addr;
+	if (entry >= size || node_index[entry] < 0) { return false; }
+	m_entry = node_index[entry];
+
+	m_nodes.Create(count);
+	for (int iptr = gMetaData_Size, n = 0; iptr < size; ++n) {
+		Node &node = m_nodes[n];
+		node.instr   = program[iptr].instr;
+		node.target  = false;
+		node.removed = false;
+		for (int p = 0; p < gInstr[node.instr].params; ++p) {
+			node.param[p] = program[iptr + 1 + p];
+		}
+		iptr += 1 + gInstr[node.instr].params;
+	}
+
+	// Jumps address nodes while the stream is being rewritten
+	m_nodes[m_entry].target = true;
+	for (int n = 0; n < count; ++n) {
+		if (IsJump(m_nodes[n].instr)) {
+			const int target = m_nodes[n].param[0].u_addr;
+			if (target >= size || node_index[target] < 0) { return false; }
+			m_nodes[n].param[0].u_addr = (addr_t)node_index[target];
+			m_nodes[node_index[target]].target = true;
+		}
+	}
+	return true;
+}
+
+void swsl::Optimizer::Store(mtlArray<Instruction> &program) const
+{
+	mtlArray<int> stream_index;
+	stream_index.Create(mmlMax(m_nodes.GetSize(), 1));
+	int size = gMetaData_Size;
+	for (int n = 0; n < m_nodes.GetSize(); ++n) {
+		stream_index[n] = size;
+		if (!m_nodes[n].removed) {
+			size += 1 + gInstr[m_nodes[n].instr].params;
+		}
+	}
+
+	program.Create(size);
+	for (int i = 0; i < gMetaData_Size; ++i) {
+		program[i] = m_header[i];
+	}
+	program[gMetaData_EntryIndex].u_addr = (addr_t)stream_index[m_entry];
+	for (int n = 0; n < m_nodes.GetSize(); ++n) {
+		const Node &node = m_nodes[n];
+		if (node.removed) { continue; }
+		int iptr = stream_index[n];
+		program[iptr].instr = node.instr;
+		for (int p = 0; p < gInstr[node.instr].params; ++p) {
+			program[iptr + 1 + p] = node.param[p];
+		}
+		if (IsJump(node.instr)) {
+			program[iptr + 1].u_addr = (addr_t)stream_index[node.param[0].u_addr];
+		}
+	}
+}
+
+int swsl::Optimizer::Next(int node) const
+{
+	do {
+		++node;
+	} while (node < m_nodes.GetSize() && m_nodes[node].removed);
+	return node;
+}
+
+// Jumps to a removed node land on the next node that is kept
+int swsl::Optimizer::Land(int node) const
+{
+	return (node < m_nodes.GetSize() && m_nodes[node].removed) ? Next(node) : node;
+}
+
+// Does the operand of the node address the slot? Vector operands span several slots.
+bool swsl::Optimizer::Covers(int node, int param, addr_t slot) const
+{
+	const Node &n = m_nodes[node];
+	return slot >= n.param[param].u_addr && (int)slot < (int)n.param[param].u_addr + OperandSlots(n.instr, param);
+}
+
+bool swsl::Optimizer::Reads(int node, addr_t slot) const
+{
+	const Node &n = m_nodes[node];
+	const int params = gInstr[n.instr].params;
+	if (params < 1 || IsJump(n.instr)) { return false; }
+	if (ReadsDestination(n.instr) && Covers(node, 0, slot)) { return true; }
+	if (params < 2) { return false; }
+	if (!SWSL_INSTR_IMM_PARAM2(n.instr) && n.instr != FLT_MSET_MI && !IsCountOperand(n.instr) && Covers(node, 1, slot)) { return true; }
+	return params == 3 && Covers(node, 2, slot);
+}
+
+bool swsl::Optimizer::IsDeadAfter(int node, addr_t slot) const
+{
+	// Inputs are observable by the caller
+	if ((int)slot < (int)m_header[gMetaData_InputIndex].u_addr) { return false; }
+
+	// Only straight line code is followed, any branch is assumed to read the slot
+	for (int n = Next(node); n < m_nodes.GetSize(); n = Next(n)) {
+		const InstructionSet instr = m_nodes[n].instr;
+		if (instr == END || instr == RETURN) { return true; }
+		if (IsJump(instr) || instr == TST_RETURN) { return false; }
+		if (Reads(n, slot)) { return false; }
+		if (WritesDestination(instr) && Covers(n, 0, slot)) { return true; }
+	}
+	return true;
+}
+
+bool swsl::Optimizer::IsRemovable(int node) const
+{
+	// Jumps to a removed instruction land on the next one, so there has to be one
+	return !m_nodes[node].target || Next(node) < m_nodes.GetSize();
+}
+
+// Jumps to a removed instruction land on the next one, which must then be kept apart from its predecessor
+void swsl::Optimizer::Remove(int node)
+{
+	m_nodes[node].removed = true;
+	if (m_nodes[node].target) {
+		const int next = Next(node);
+		if (next < m_nodes.GetSize()) { m_nodes[next].target = true; }
+	}
+}
+
+bool swsl::Optimizer::IsNoOp(int node) const
+{
+	const Node &n = m_nodes[node];
+	switch (n.instr) {
+	case NOP:        return true;
+	case FLT_SET_MM: return n.param[0].u_addr == n.param[1].u_addr;
+	case FLT_ADD_MI:
+	case FLT_SUB_MI: return n.param[1].fl_imm == 0.0f;
+	case FLT_MUL_MI:
+	case FLT_DIV_MI: return n.param[1].fl_imm == 1.0f;
+	case UNS_JMP_I:
+	case TST_JMP_FAIL_I:
+	case TST_JMP_PASS_I: return Land(n.param[0].u_addr) == Next(node);
+	default: break;
+	}
+	return false;
+}
+
+int swsl::Optimizer::RemoveNoOps( void )
+{
+	int removed = 0;
+	for (int n = Next(-1); n < m_nodes.GetSize(); n = Next(n)) {
+		if (IsNoOp(n) && IsRemovable(n)) {
+			Remove(n);
+			++removed;
+		}
+	}
+	return removed;
+}
+
+int swsl::Optimizer::RemoveDeadStores( void )
+{
+	// op a x; set a y -> set a y, when the second instruction does not read a
+	int removed = 0;
+	for (int n = Next(-1); n < m_nodes.GetSize(); n = Next(n)) {
+		const int m = Next(n);
+		if (m >= m_nodes.GetSize()) { break; }
+		const Node &first  = m_nodes[n];
+		const Node &second = m_nodes[m];
+		if (
+			WritesDestination(first.instr) && WritesDestination(second.instr) &&
+			OperandSlots(first.instr, 0) == 1 && first.param[0].u_addr == second.param[0].u_addr &&
+			!Reads(m, first.param[0].u_addr) && IsRemovable(n)
+		) {
+			Remove(n);
+			++removed;
+		}
+	}
+	return removed;
+}
+
+int swsl::Optimizer::RemoveDeadLocals( void )
+{
+	// set t x; ... end -> ... end, when t is a local that is not read before the program ends or t is written again
+	int removed = 0;
+	for (int n = Next(-1); n < m_nodes.GetSize(); n = Next(n)) {
+		const Node &node = m_nodes[n];
+		if (
+			gInstr[node.instr].params >= 1 && !IsJump(node.instr) && WritesDestination(node.instr) &&
+			OperandSlots(node.instr, 0) == 1 && IsDeadAfter(n, node.param[0].u_addr) && IsRemovable(n)
+		) {
+			Remove(n);
+			++removed;
+		}
+	}
+	return removed;
+}
+
+int swsl::Optimizer::RemoveMaskPairs( void )
+{
+	// tst_push; tst_pop leaves both the mask and the mask stack unchanged
+	// A jump to the push lands on the instruction after the pop, so there has to be one
+	int removed = 0;
+	for (int n = Next(-1); n < m_nodes.GetSize(); n = Next(n)) {
+		const int m = Next(n);
+		if (m >= m_nodes.GetSize()) { break; }
+		if (
+			m_nodes[n].instr == TST_PUSH && m_nodes[m].instr == TST_POP && !m_nodes[m].target &&
+			(!m_nodes[n].target || Next(m) < m_nodes.GetSize())
+		) {
+			Remove(m);
+			Remove(n);
+			removed += 2;
+		}
+	}
+	return removed;
+}
+
+int swsl::Optimizer::FoldImmediates( void )
+{
+	// add a 1; add a 2 -> add a 3
+	int removed = 0;
+	for (int n = Next(-1); n < m_nodes.GetSize(); n = Next(n)) {
+		const int m = Next(n);
+		if (m >= m_nodes.GetSize()) { break; }
+		Node &first  = m_nodes[n];
+		Node &second = m_nodes[m];
+		if (second.target || first.param[0].u_addr != second.param[0].u_addr || !SWSL_INSTR_IMM_PARAM2(first.instr) || !SWSL_INSTR_IMM_PARAM2(second.instr)) { continue; }
+
+		const float a = first.param[1].fl_imm;
+		const float b = second.param[1].fl_imm;
+		float       c;
+		switch (first.instr) {
+		case FLT_SET_MI: // constant is computed once instead of per fragment
+			switch (second.instr) {
+			case FLT_ADD_MI: c = a + b; break;
+			case FLT_SUB_MI: c = a - b; break;
+			case FLT_MUL_MI: c = a * b; break;
+			case FLT_DIV_MI: c = a / b; break;
+			default: continue;
+			}
+			break;
+		case FLT_ADD_MI:
+		case FLT_SUB_MI:
+			if (second.instr != FLT_ADD_MI && second.instr != FLT_SUB_MI) { continue; }
+			c = (first.instr == FLT_ADD_MI ? a : -a) + (second.instr == FLT_ADD_MI ? b : -b);
+			first.instr = FLT_ADD_MI;
+			break;
+		case FLT_MUL_MI:
+		case FLT_DIV_MI:
+			if (second.instr != first.instr) { continue; }
+			c = a * b;
+			break;
+		default: continue;
+		}
+		first.param[1].fl_imm = c;
+		second.removed = true;
+		++removed;
+	}
+	return removed;
+}
+
+int swsl::Optimizer::FuseThreeOperand( void )
+{
+	// set a b; op a c -> op a b c
+	int fused = 0;
+	for (int n = Next(-1); n < m_nodes.GetSize(); n = Next(n)) {
+		Node &first = m_nodes[n];
+		const int m = Next(n);
+		if (first.instr != FLT_SET_MM || m >= m_nodes.GetSize()) { continue; }
+		Node &second = m_nodes[m];
+		if (second.target || second.param[0].u_addr != first.param[0].u_addr || second.param[1].u_addr == first.param[0].u_addr) { continue; }
+
+		InstructionSet instr;
+		switch (second.instr) {
+		case FLT_ADD_MM: instr = FLT_ADD_MMM; break;
+		case FLT_SUB_MM: instr = FLT_SUB_MMM; break;
+		case FLT_MUL_MM: instr = FLT_MUL_MMM; break;
+		case FLT_DIV_MM: instr = FLT_DIV_MMM; break;
+		default: continue;
+		}
+		first.instr    = instr;
+		first.param[2] = second.param[1];
+		second.removed = true;
+		++fused;
+	}
+	return fused;
+}
+
+int swsl::Optimizer::FuseMultiplyAdd( void )
+{
+	// mul a b; add a c -> mad a b c
+	int fused = 0;
+	for (int n = Next(-1); n < m_nodes.GetSize(); n = Next(n)) {
+		Node &first = m_nodes[n];
+		const int m = Next(n);
+		if (first.instr != FLT_MUL_MM || m >= m_nodes.GetSize()) { continue; }
+		Node &second = m_nodes[m];
+		if (second.target || second.param[0].u_addr != first.param[0].u_addr || second.param[1].u_addr == first.param[0].u_addr) { continue; }
+
+		InstructionSet instr;
+		switch (second.instr) {
+		case FLT_ADD_MM: instr = FLT_MAD_MMM;  break;
+		case FLT_SUB_MM: instr = FLT_MSUB_MMM; break;
+		default: continue;
+		}
+		first.instr    = instr;
+		first.param[2] = second.param[1];
+		second.removed = true;
+		++fused;
+	}
+	return fused;
+}
+
+int swsl::Optimizer::FuseLerp( void )
+{
+	// sub t b a; mul t c; add a t -> lerp a b c, provided t is not read afterwards
+	int fused = 0;
+	for (int n = Next(-1); n < m_nodes.GetSize(); n = Next(n)) {
+		Node &first = m_nodes[n];
+		const int m = Next(n);
+		const int k = m < m_nodes.GetSize() ? Next(m) : m;
+		if (first.instr != FLT_SUB_MMM || k >= m_nodes.GetSize()) { continue; }
+		Node &second = m_nodes[m];
+		Node &third  = m_nodes[k];
+		if (second.instr != FLT_MUL_MM || third.instr != FLT_ADD_MM || second.target || third.target) { continue; }
+
+		const addr_t t = first.param[0].u_addr;
+		const addr_t a = first.param[2].u_addr;
+		if (
+			t == a ||
+			second.param[0].u_addr != t || second.param[1].u_addr == t ||
+			third.param[0].u_addr != a || third.param[1].u_addr != t ||
+			!IsDeadAfter(k, t)
+		) {
+			continue;
+		}
+		first.instr    = FLT_LERP_MMM;
+		first.param[0] = third.param[0];
+		first.param[2] = second.param[1];
+		second.removed = true;
+		third.removed  = true;
+		fused += 2;
+	}
+	return fused;
+}
+
+int swsl::Optimizer::Simplify(mtlArray<Instruction> &program)
+{
+	// Malformed programs are left untouched for the loader to diagnose
+	if (!Load(program)) { return 0; }
+	int removed = 0;
+	for (;;) {
+		// Removing one instruction can expose another, repeat until nothing changes
+		int pass = FoldImmediates();
+		pass += RemoveNoOps();
+		pass += RemoveDeadStores();
+		pass += RemoveDeadLocals();
+		pass += RemoveMaskPairs();
+		if (pass == 0) { break; }
+		removed += pass;
+	}
+	if (removed > 0) {
+		Store(program);
+	}
+	return removed;
+}
+
+int swsl::Optimizer::FuseInstructions(mtlArray<Instruction> &program)
+{
+	if (!Load(program)) { return 0; }
+	int removed = FuseThreeOperand();
+	removed += FuseLerp();
+	removed += FuseMultiplyAdd();
+	if (removed > 0) {
+		Store(program);
+	}
+	return removed;
+}
+
+int swsl::Optimizer::Optimize(mtlArray<Instruction> &program)
+{
+	const int removed = Simplify(program);
+	return removed + FuseInstructions(program);
+}
+
+static float AsFloat(unsigned int bits)
+{
+	union { unsigned int u; float f; } x;
+	x.u = bits;
+	return x.f;
+}
+
+static unsigned int AsBits(float f)
+{
+	union { float f; unsigned int u; } x;
+	x.f = f;
+	return x.u;
+}
+
+// Is there an _MI form of the instruction that follows it in the instruction set?
+static bool HasImmediateForm(swsl::InstructionSet instr)
+{
+	return instr == swsl::FLT_MSET_MM || (!SWSL_INSTR_IMM_PARAM2(instr) && SWSL_INSTR_IMM_PARAM2(instr + 1));
+}
+
+// Does the instruction produce an integer or boolean value?
+static bool IsIntegerResult(swsl::InstructionSet instr)
+{
+	return instr >= swsl::TST_STORE_M && instr <= swsl::INT_BOOL_MM && instr != swsl::FLT_INT_MM;
+}
+
+// Comparisons and loads of the test register
+static bool WritesTest(swsl::InstructionSet instr)
+{
+	return instr == swsl::TST_LOAD_M || (swsl::gInstr[instr].params == 2 && !swsl::WritesDestination(instr));
+}
+
+static bool ReadsTest(swsl::InstructionSet instr)
+{
+	return instr == swsl::TST_AND || instr == swsl::TST_OR || instr == swsl::TST_STORE_M;
+}
+
+static bool WritesMask(swsl::InstructionSet instr)
+{
+	return instr == swsl::TST_AND || instr == swsl::TST_OR || instr == swsl::TST_INV;
+}
+
+static bool ReadsMask(swsl::InstructionSet instr)
+{
+	switch (instr) {
+	case swsl::TST_PUSH:
+	case swsl::TST_AND:
+	case swsl::TST_OR:
+	case swsl::TST_INV:
+	case swsl::TST_JMP_FAIL_I:
+	case swsl::TST_JMP_PASS_I:
+	case swsl::FLT_MSET_MM:
+	case swsl::FLT_MSET_MI:
+		return true;
+	default: break;
+	}
+	return false;
+}
+
+bool swsl::Optimizer::IsSlotOperand(int node, int param) const
+{
+	const InstructionSet instr = m_nodes[node].instr;
+	if (param >= gInstr[instr].params || IsJump(instr)) { return false; }
+	return param != 1 || (!SWSL_INSTR_IMM_PARAM2(instr) && instr != FLT_MSET_MI && !IsCountOperand(instr));
+}
+
+// Vector operands are not tracked
+swsl::Optimizer::Fact swsl::Optimizer::Operand(int node, int param, const Fact *state) const
+{
+	const Node &n = m_nodes[node];
+	Fact f = { 0, false };
+	if (IsSlotOperand(node, param)) {
+		if (OperandSlots(n.instr, param) == 1) { f = state[FACT_STACK + 2 * m_stack + n.param[param].u_addr]; }
+	} else if (param == 1 && IsCountOperand(n.instr)) {
+		f.bits  = n.param[1].u_addr;
+		f.known = true;
+	} else if (param == 1 && param < gInstr[n.instr].params) {
+		f.bits  = (unsigned int)n.param[1].in_imm;
+		f.known = true;
+	}
+	return f;
+}
+
+// Value the node produces: the conditional mask for mask operations, the test register for comparisons and the
+// destination otherwise. Only operations that give the same result here and in every build of the VM are folded.
+swsl::Optimizer::Fact swsl::Optimizer::Compute(int node, const Fact *state) const
+{
+	const InstructionSet instr = m_nodes[node].instr;
+	const Fact           mask  = state[FACT_MASK];
+	const Fact           test  = state[FACT_TEST];
+	const Fact           a     = Operand(node, 0, state);
+	const Fact           b     = Operand(node, 1, state);
+	const Fact           c     = Operand(node, 2, state);
+	const float          fa    = AsFloat(a.bits);
+	const float          fb    = AsFloat(b.bits);
+	const float          fc    = AsFloat(c.bits);
+	const int            ia    = (int)a.bits;
+	const int            ib    = (int)b.bits;
+	const bool           ab    = a.known && b.known;
+	const bool           ordered = ab && fa == fa && fb == fb && (fa != fb || a.bits == b.bits); // min and max do not agree on NaN and signed zero
+
+	Fact r = { 0, false };
+	switch (instr) {
+	case TST_AND:
+		if ((mask.known && mask.bits == 0) || (test.known && test.bits == 0)) { r.known = true; }
+		else if (mask.known && mask.bits == ~0u)                              { r = test; }
+		else if (test.known && test.bits == ~0u)                              { r = mask; }
+		break;
+	case TST_OR:
+		if ((mask.known && mask.bits == ~0u) || (test.known && test.bits == ~0u)) { r.bits = ~0u; r.known = true; }
+		else if (mask.known && mask.bits == 0)                                   { r = test; }
+		else if (test.known && test.bits == 0)                                   { r = mask; }
+		break;
+	case TST_INV:
+		r.bits  = ~mask.bits;
+		r.known = mask.known;
+		break;
+	case TST_STORE_M: return test;
+	case TST_LOAD_M:  return a;
+
+	case FLT_MSET_MM:
+	case FLT_MSET_MI:
+		if (mask.known && mask.bits == ~0u)             { r = b; }
+		else if (mask.known && mask.bits == 0)          { r = a; }
+		else if (ab && a.bits == b.bits)                { r = a; }
+		break;
+
+	case FLT_SET_MM:
+	case FLT_SET_MI:
+	case INT_SET_MM:
+	case INT_SET_MI: return b;
+
+	case FLT_ADD_MM:
+	case FLT_ADD_MI:  r.bits = AsBits(fa + fb); r.known = ab; break;
+	case FLT_SUB_MM:
+	case FLT_SUB_MI:  r.bits = AsBits(fa - fb); r.known = ab; break;
+	case FLT_MUL_MM:
+	case FLT_MUL_MI:  r.bits = AsBits(fa * fb); r.known = ab; break;
+	case FLT_DIV_MM:
+	case FLT_DIV_MI:  r.bits = AsBits(fa / fb); r.known = ab; break;
+	case FLT_ADD_MMM: r.bits = AsBits(fb + fc); r.known = b.known && c.known; break;
+	case FLT_SUB_MMM: r.bits = AsBits(fb - fc); r.known = b.known && c.known; break;
+	case FLT_MUL_MMM: r.bits = AsBits(fb * fc); r.known = b.known && c.known; break;
+	case FLT_DIV_MMM: r.bits = AsBits(fb / fc); r.known = b.known && c.known; break;
+	case FLT_MIN_MM:
+	case FLT_MIN_MI:  r.bits = fa < fb ? a.bits : b.bits; r.known = ordered; break;
+	case FLT_MAX_MM:
+	case FLT_MAX_MI:  r.bits = fa > fb ? a.bits : b.bits; r.known = ordered; break;
+
+	case FLT_EQ_MM:
+	case FLT_EQ_MI:   r.bits = fa == fb ? ~0u : 0; r.known = ab; break;
+	case FLT_NEQ_MM:
+	case FLT_NEQ_MI:  r.bits = fa != fb ? ~0u : 0; r.known = ab; break;
+	case FLT_LT_MM:
+	case FLT_LT_MI:   r.bits = fa < fb ? ~0u : 0;  r.known = ab; break;
+	case FLT_LTE_MM:
+	case FLT_LTE_MI:  r.bits = fa <= fb ? ~0u : 0; r.known = ab; break;
+	case FLT_GT_MM:
+	case FLT_GT_MI:   r.bits = fa > fb ? ~0u : 0;  r.known = ab; break;
+	case FLT_GTE_MM:
+	case FLT_GTE_MI:  r.bits = fa >= fb ? ~0u : 0; r.known = ab; break;
+
+	case INT_ADD_MM:
+	case INT_ADD_MI:  r.bits = a.bits + b.bits; r.known = ab; break;
+	case INT_SUB_MM:
+	case INT_SUB_MI:  r.bits = a.bits - b.bits; r.known = ab; break;
+	case INT_MUL_MM:
+	case INT_MUL_MI:  r.bits = a.bits * b.bits; r.known = ab; break;
+	case INT_AND_MM:
+	case INT_AND_MI:
+	case BOOL_AND_MM: r.bits = a.bits & b.bits; r.known = ab; break;
+	case INT_OR_MM:
+	case INT_OR_MI:
+	case BOOL_OR_MM:  r.bits = a.bits | b.bits; r.known = ab; break;
+	case INT_XOR_MM:
+	case INT_XOR_MI:
+	case BOOL_XOR_MM: r.bits = a.bits ^ b.bits; r.known = ab; break;
+
+	case INT_EQ_MM:
+	case INT_EQ_MI:   r.bits = ia == ib ? ~0u : 0; r.known = ab; break;
+	case INT_NEQ_MM:
+	case INT_NEQ_MI:  r.bits = ia != ib ? ~0u : 0; r.known = ab; break;
+	case INT_LT_MM:
+	case INT_LT_MI:   r.bits = ia < ib ? ~0u : 0;  r.known = ab; break;
+	case INT_LTE_MM:
+	case INT_LTE_MI:  r.bits = ia <= ib ? ~0u : 0; r.known = ab; break;
+	case INT_GT_MM:
+	case INT_GT_MI:   r.bits = ia > ib ? ~0u : 0;  r.known = ab; break;
+	case INT_GTE_MM:
+	case INT_GTE_MI:  r.bits = ia >= ib ? ~0u : 0; r.known = ab; break;
+
+	case INT_SHL_MC:  r.bits = a.bits << b.bits;               r.known = ab && b.bits < 32; break;
+	case INT_SHR_MC:  r.bits = (unsigned int)(ia >> b.bits);   r.known = ab && b.bits < 32; break;
+	case INT_NEG_MM:  r.bits = 0u - b.bits;                    r.known = b.known; break;
+	case INT_NOT_MM:
+	case BOOL_NOT_MM: r.bits = ~b.bits;                        r.known = b.known; break;
+	case INT_FLT_MM:  r.bits = (unsigned int)(int)fb;          r.known = b.known && fb > -2147483904.0f && fb < 2147483648.0f; break;
+	case FLT_INT_MM:  r.bits = AsBits((float)ib);              r.known = b.known; break;
+	case INT_BOOL_MM: r.bits = b.bits != 0 ? 1 : 0;            r.known = b.known && (b.bits == 0 || b.bits == ~0u); break;
+
+	default: break;
+	}
+	return r;
+}
+
+// Applies the node to the state. Fails if the mask stack over- or underflows.
+bool swsl::Optimizer::Evaluate(int node, Fact *state, int &depth) const
+{
+	const Node &n     = m_nodes[node];
+	Fact       *slots = state + FACT_STACK + 2 * m_stack;
+	Fact        self  = { (unsigned int)node, true };
+
+	switch (n.instr) {
+	case TST_PUSH:
+		if (depth >= m_stack) { return false; }
+		state[FACT_STACK + 2 * depth]     = state[FACT_MASK];
+		state[FACT_STACK + 2 * depth + 1] = self;
+		++depth;
+		return true;
+	case TST_POP:
+		if (depth <= 0) { return false; }
+		--depth;
+		state[FACT_MASK]      = state[FACT_STACK + 2 * depth];
+		state[FACT_MASK_NODE] = self;
+		return true;
+	default: break;
+	}
+
+	if (WritesMask(n.instr)) {
+		state[FACT_MASK]      = Compute(node, state);
+		state[FACT_MASK_NODE] = self;
+	} else if (WritesTest(n.instr)) {
+		state[FACT_TEST]      = Compute(node, state);
+		state[FACT_TEST_NODE] = self;
+	} else if (gInstr[n.instr].params >= 1 && !IsJump(n.instr) && WritesDestination(n.instr)) {
+		const int width = OperandSlots(n.instr, 0);
+		if (width == 1) {
+			slots[n.param[0].u_addr] = Compute(node, state);
+		} else {
+			for (int i = 0; i < width; ++i) { slots[n.param[0].u_addr + i].known = false; }
+		}
+	}
+	return true;
+}
+
+// Branches the mask decides go one way. A failing jump under a full mask is only taken
+// by blocks without coverage, which write nothing, so it is treated as never taken.
+void swsl::Optimizer::Successors(int node, const Fact *state, bool &fall, bool &jump) const
+{
+	const Fact mask = state[FACT_MASK];
+	const bool none = mask.known && mask.bits == 0;
+	const bool all  = mask.known && mask.bits == ~0u;
+	fall = true;
+	jump = false;
+	switch (m_nodes[node].instr) {
+	case END:
+	case RETURN:         fall = false; break;
+	case UNS_JMP_I:      fall = false; jump = true; break;
+	case TST_JMP_FAIL_I: fall = !none; jump = !all; break;
+	case TST_JMP_PASS_I: jump = !none; break;
+	default: break;
+	}
+}
+
+// Joins a state into the state at the start of a block. Fails if the mask stack depths differ.
+bool swsl::Optimizer::Merge(int block, const Fact *state, int depth, bool &changed)
+{
+	Fact *facts = &m_facts[block * m_width];
+	changed = false;
+	if (m_depth[block] < 0) {
+		for (int i = 0; i < m_width; ++i) { facts[i] = state[i]; }
+		m_depth[block] = depth;
+		changed = true;
+		return true;
+	}
+	if (m_depth[block] != depth) { return false; }
+	for (int i = 0; i < m_width; ++i) {
+		if (facts[i].known && (!state[i].known || state[i].bits != facts[i].bits)) {
+			facts[i].known = false;
+			changed = true;
+		}
+	}
+	return true;
+}
+
+// Rewrites the node for the state it runs in, the result stays the same
+bool swsl::Optimizer::Rewrite(int node, const Fact *state)
+{
+	Node &n = m_nodes[node];
+	const Fact mask = state[FACT_MASK];
+	const bool none = mask.known && mask.bits == 0;
+	const bool all  = mask.known && mask.bits == ~0u;
+	bool changed = false;
+
+	switch (n.instr) {
+	case TST_JMP_FAIL_I:
+		if (none) { n.instr = UNS_JMP_I; return true; }
+		if (all)  { n.instr = NOP;       return true; }
+		return false;
+	case TST_JMP_PASS_I:
+		if (none) { n.instr = NOP; return true; }
+		return false;
+	case TST_AND:
+	case TST_OR: {
+		const Fact r = Compute(node, state);
+		if (mask.known && r.known && r.bits == mask.bits) { n.instr = NOP; return true; }
+		return false;
+	}
+	case FLT_MSET_MM:
+	case FLT_MSET_MI:
+		if (none) { n.instr = NOP; return true; }
+		if (all) {
+			n.instr = n.instr == FLT_MSET_MM ? FLT_SET_MM : FLT_SET_MI;
+			changed = true;
+		}
+		break;
+	default: break;
+	}
+	if (n.instr == FLT_SET_MI || n.instr == INT_SET_MI) { return changed; }
+
+	// Known results become immediates
+	if (IsSlotOperand(node, 0) && WritesDestination(n.instr) && OperandSlots(n.instr, 0) == 1) {
+		const Fact r = Compute(node, state);
+		if (r.known) {
+			n.instr           = IsIntegerResult(n.instr) ? INT_SET_MI : FLT_SET_MI;
+			n.param[1].in_imm = (int)r.bits;
+			return true;
+		}
+	}
+	// Known sources become immediates
+	if (HasImmediateForm(n.instr) && OperandSlots(n.instr, 1) == 1) {
+		const Fact b = Operand(node, 1, state);
+		if (b.known) {
+			n.instr           = (InstructionSet)(n.instr + 1);
+			n.param[1].in_imm = (int)b.bits;
+			return true;
+		}
+	}
+	return changed;
+}
+
+// One round of constant propagation over the loaded nodes. Returns the number of nodes changed or removed,
+// or -1 if the program can not be analyzed.
+int swsl::Optimizer::SpecializeNodes(const float *constants, int count)
+{
+	const int nodes = m_nodes.GetSize();
+
+	int slots = count;
+	m_stack = 0;
+	for (int n = 0; n < nodes; ++n) {
+		if (m_nodes[n].instr == TST_PUSH) { ++m_stack; }
+		for (int p = 0; p < 3; ++p) {
+			if (IsSlotOperand(n, p)) { slots = mmlMax(slots, (int)m_nodes[n].param[p].u_addr + OperandSlots(m_nodes[n].instr, p)); }
+		}
+	}
+	m_width = FACT_STACK + 2 * m_stack + slots;
+
+	int blocks = 0;
+	m_block.Create(nodes);
+	for (int n = 0; n < nodes; ++n) {
+		m_block[n] = m_nodes[n].target ? blocks++ : -1;
+	}
+	mtlArray<int> start;
+	start.Create(mmlMax(blocks, 1));
+	for (int n = 0; n < nodes; ++n) {
+		if (m_block[n] >= 0) { start[m_block[n]] = n; }
+	}
+	m_facts.Create(mmlMax(blocks * m_width, 1));
+	m_depth.Create(mmlMax(blocks, 1));
+	for (int b = 0; b < blocks; ++b) { m_depth[b] = -1; }
+
+	// Every fragment is enabled when the program starts, nothing but the constants is known
+	const Fact     unknown = { 0, false };
+	const Fact     no_node = { ~0u, true };
+	mtlArray<Fact> state;
+	state.Create(m_width);
+	for (int i = 0; i < m_width; ++i) { state[i] = unknown; }
+	state[FACT_MASK].bits  = ~0u;
+	state[FACT_MASK].known = true;
+	state[FACT_MASK_NODE]  = no_node;
+	state[FACT_TEST_NODE]  = no_node;
+	for (int i = 0; i < count; ++i) {
+		state[FACT_STACK + 2 * m_stack + i].bits  = AsBits(constants[i]);
+		state[FACT_STACK + 2 * m_stack + i].known = true;
+	}
+
+	// Propagate states between blocks until they settle
+	mtlArray<int>  work;
+	mtlArray<char> queued;
+	work.Create(mmlMax(blocks, 1));
+	queued.Create(mmlMax(blocks, 1));
+	for (int b = 0; b < blocks; ++b) { queued[b] = 0; }
+	int  top = 0;
+	bool changed;
+	if (!Merge(m_block[m_entry], &state[0], 0, changed)) { return -1; }
+	work[top++] = m_block[m_entry];
+	queued[m_block[m_entry]] = 1;
+	while (top > 0) {
+		const int block = work[--top];
+		queued[block] = 0;
+		int depth = m_depth[block];
+		for (int i = 0; i < m_width; ++i) { state[i] = m_facts[block * m_width + i]; }
+		for (int n = start[block];; ++n) {
+			bool fall, jump;
+			Successors(n, &state[0], fall, jump);
+			if (!Evaluate(n, &state[0], depth)) { return -1; }
+			if (fall && n + 1 >= nodes) { return -1; }
+			const int succ[2] = {
+				jump ? m_block[m_nodes[n].param[0].u_addr] : -1,
+				(fall && m_nodes[n + 1].target) ? m_block[n + 1] : -1
+			};
+			for (int s = 0; s < 2; ++s) {
+				if (succ[s] < 0) { continue; }
+				if (!Merge(succ[s], &state[0], depth, changed)) { return -1; }
+				if (changed && queued[succ[s]] == 0) {
+					work[top++] = succ[s];
+					queued[succ[s]] = 1;
+				}
+			}
+			if (!fall || m_nodes[n + 1].target) { break; }
+		}
+	}
+
+	// Rewrite every reachable node under the state it runs in, and note which values of the
+	// mask and test registers are read and which saved masks are restored over a different mask
+	mtlArray<char> reached, test_read, mask_read, keep_push;
+	mtlArray<int>  pushed_by;
+	reached.Create(nodes);
+	test_read.Create(nodes);
+	mask_read.Create(nodes);
+	keep_push.Create(nodes);
+	pushed_by.Create(nodes);
+	for (int n = 0; n < nodes; ++n) {
+		reached[n]   = 0;
+		test_read[n] = 0;
+		mask_read[n] = 0;
+		keep_push[n] = 0;
+		pushed_by[n] = -1;
+	}
+	bool keep_tests = false, keep_masks = false, keep_pairs = false;
+	int  changes = 0;
+	for (int block = 0; block < blocks; ++block) {
+		if (m_depth[block] < 0) { continue; }
+		int depth = m_depth[block];
+		for (int i = 0; i < m_width; ++i) { state[i] = m_facts[block * m_width + i]; }
+		for (int n = start[block];; ++n) {
+			reached[n] = 1;
+			if (Rewrite(n, &state[0])) { ++changes; }
+
+			const InstructionSet instr = m_nodes[n].instr;
+			if (ReadsTest(instr)) {
+				const Fact origin = state[FACT_TEST_NODE];
+				if (!origin.known)                     { keep_tests = true; }
+				else if (origin.bits < (unsigned)nodes) { test_read[origin.bits] = 1; }
+			}
+			if (ReadsMask(instr)) {
+				const Fact origin = state[FACT_MASK_NODE];
+				if (!origin.known)                     { keep_masks = true; }
+				else if (origin.bits < (unsigned)nodes) { mask_read[origin.bits] = 1; }
+			}
+			if (instr == TST_POP && depth > 0) {
+				const Fact saved  = state[FACT_STACK + 2 * (depth - 1)];
+				const Fact origin = state[FACT_STACK + 2 * (depth - 1) + 1];
+				const Fact mask   = state[FACT_MASK];
+				if (!origin.known || origin.bits >= (unsigned)nodes) {
+					keep_pairs = true;
+				} else {
+					pushed_by[n] = (int)origin.bits;
+					if (!saved.known || !mask.known || saved.bits != mask.bits) { keep_push[origin.bits] = 1; }
+				}
+			}
+
+			bool fall, jump;
+			Successors(n, &state[0], fall, jump);
+			if (!Evaluate(n, &state[0], depth)) { return -1; }
+			if (!fall || n + 1 >= nodes || m_nodes[n + 1].target) { break; }
+		}
+	}
+
+	// Values of the mask and test registers nobody reads are not computed. A saved mask is dropped
+	// along with the pops that restore it over the same mask, but not in the same round as a write
+	// to the mask it was compared against.
+	int mask_writes = 0;
+	for (int n = 0; n < nodes; ++n) {
+		Node &node = m_nodes[n];
+		if (reached[n] == 0) {
+			node.removed = true;
+			++changes;
+		} else if (WritesTest(node.instr) && !keep_tests && test_read[n] == 0) {
+			node.instr = NOP;
+			++changes;
+		} else if (WritesMask(node.instr) && !keep_masks && mask_read[n] == 0) {
+			node.instr = NOP;
+			++changes;
+			++mask_writes;
+		}
+	}
+	if (mask_writes == 0 && !keep_pairs) {
+		for (int n = 0; n < nodes; ++n) {
+			Node &node = m_nodes[n];
+			if (reached[n] == 0) { continue; }
+			if (
+				(node.instr == TST_PUSH && keep_push[n] == 0) ||
+				(node.instr == TST_POP && pushed_by[n] >= 0 && keep_push[pushed_by[n]] == 0)
+			) {
+				node.instr = NOP;
+				++changes;
+			}
+		}
+	}
+	return changes;
+}
+
+// Specializes the program for the values of its first count inputs, which must be the same in every lane.
+// Values that follow from the constants become immediates, branches they decide are resolved and code that
+// can no longer run is dropped. Programs that can not be analyzed are left as they are.
+int swsl::Optimizer::Specialize(mtlArray<Instruction> &program, const float *constants, int count)
+{
+	int changes = 0;
+	for (;;) {
+		// Removing one instruction can make another one unused, repeat until nothing changes
+		if (!Load(program)) { break; }
+		const int pass = SpecializeNodes(constants, count);
+		if (pass <= 0) { break; }
+		Store(program);
+		changes += pass + Simplify(program);
+	}
+	return changes + FuseInstructions(program);
+}
@@ -0,0 +1,90 @@
+#ifndef SWSL_OPTIMIZE_H_INCLUDED__
+#define SWSL_OPTIMIZE_H_INCLUDED__
+
+#include "MiniLib/MTL/mtlArray.h"
+#include "swsl_instr.h"
+
+namespace swsl
+{
+
+// Rewrites instruction streams in place. Jump targets and the entry point are remapped
+// to the rewritten stream. Instructions that are jumped to are never merged into a
+// preceding instruction, but removed no-ops forward jumps to the instruction after them.
+class Optimizer
+{
+private:
+	struct Node
+	{
+		InstructionSet instr;
+		Instruction    param[3];
+		bool           target;  // entry point or destination of a jump
+		bool           removed;
+	};
+
+	// What Specialize knows about a value: a frame slot, the test register, the conditional mask
+	// or a saved mask. Known values are the same in every lane.
+	struct Fact
+	{
+		unsigned int bits;
+		bool         known;
+	};
+
+	enum FactIndex
+	{
+		FACT_MASK,
+		FACT_MASK_NODE, // node that last wrote the conditional mask
+		FACT_TEST,
+		FACT_TEST_NODE, // node that last wrote the test register
+		FACT_STACK      // saved mask and the node that pushed it, per mask stack level, followed by frame slots
+	};
+
+private:
+	mtlArray<Node> m_nodes;
+	Instruction    m_header[gMetaData_Size];
+	int            m_entry;
+	mtlArray<Fact> m_facts; // analysis state at the start of each block, see Specialize
+	mtlArray<int>  m_block; // block of each node starting one, -1 otherwise
+	mtlArray<int>  m_depth; // mask stack depth at the start of each block, -1 if not reached
+	int            m_width; // facts per state
+	int            m_stack; // mask stack levels in a state
+
+private:
+	bool Load(const mtlArray<Instruction> &program);
+	void Store(mtlArray<Instruction> &program) const;
+	int  Next(int node) const;
+	int  Land(int node) const;
+	bool Covers(int node, int param, addr_t slot) const;
+	bool Reads(int node, addr_t slot) const;
+	bool IsDeadAfter(int node, addr_t slot) const;
+	bool IsRemovable(int node) const;
+	void Remove(int node);
+	bool IsNoOp(int node) const;
+	int  RemoveNoOps( void );
+	int  RemoveDeadStores( void );
+	int  RemoveDeadLocals( void );
+	int  RemoveMaskPairs( void );
+	int  FoldImmediates( void );
+	int  FuseThreeOperand( void );
+	int  FuseMultiplyAdd( void );
+	int  FuseLerp( void );
+	bool IsSlotOperand(int node, int param) const;
+	Fact Operand(int node, int param, const Fact *state) const;
+	Fact Compute(int node, const Fact *state) const;
+	bool Evaluate(int node, Fact *state, int &depth) const;
+	void Successors(int node, const Fact *state, bool &fall, bool &jump) const;
+	bool Merge(int block, const Fact *state, int depth, bool &changed);
+	bool Rewrite(int node, const Fact *state);
+	int  SpecializeNodes(const float *constants, int count);
+
+public:
+	Optimizer( void ) : m_entry(0), m_width(0), m_stack(0) {}
+
+	int Simplify(mtlArray<Instruction> &program);
+	int FuseInstructions(mtlArray<Instruction> &program);
+	int Optimize(mtlArray<Instruction> &program);
+	int Specialize(mtlArray<Instruction> &program, const float *constants, int count);
+};
+
+}
+
+#endif // SWSL_OPTIMIZE_H_INCLUDED__
@@ -0,0 +1,133 @@
+#include "swsl_profile.h"
+
+static void PrintName(const mtlChars &name, std::ostream &out)
+{
+	out.write(name.GetChars(), name.GetSize());
+}
+
+static double Percent(swsl::Profile::Counter part, swsl::Profile::Counter total)
+{
+	return total > 0 ? (100.0 * part) / total : 0.0;
+}
+
+const char *swsl::Profile::GetMaskName(swsl::Profile::MaskState state)
+{
+	switch (state) {
+	case MASK_ALL_PASS: return "all_pass";
+	case MASK_MIXED:    return "mixed";
+	case MASK_ALL_FAIL: return "all_fail";
+	default: break;
+	}
+	return "";
+}
+
+swsl::Profile::Profile( void )
+{
+	Reset();
+}
+
+void swsl::Profile::Reset( void )
+{
+	for (int i = 0; i < INSTR_COUNT; ++i)      { m_instr[i] = 0; }
+	for (int i = 0; i < MASK_STATE_COUNT; ++i) { m_mask[i] = 0; }
+	m_runs        = 0;
+	m_blocks      = 0;
+	m_nanoseconds = 0;
+}
+
+// Combines the profiles of contexts running the same shader on different threads
+void swsl::Profile::Merge(const swsl::Profile &profile)
+{
+	for (int i = 0; i < INSTR_COUNT; ++i)      { m_instr[i] += profile.m_instr[i]; }
+	for (int i = 0; i < MASK_STATE_COUNT; ++i) { m_mask[i] += profile.m_mask[i]; }
+	m_runs        += profile.m_runs;
+	m_blocks      += profile.m_blocks;
+	m_nanoseconds += profile.m_nanoseconds;
+}
+
+swsl::Profile::Counter swsl::Profile::GetInstructionCount(swsl::InstructionSet instr) const
+{
+	return (instr >= 0 && instr < INSTR_COUNT) ? m_instr[instr] : 0;
+}
+
+swsl::Profile::Counter swsl::Profile::GetInstructionCount( void ) const
+{
+	Counter total = 0;
+	for (int i = 0; i < INSTR_COUNT; ++i) {
+		total += m_instr[i];
+	}
+	return total;
+}
+
+swsl::Profile::Counter swsl::Profile::GetMaskCount(swsl::Profile::MaskState state) const
+{
+	return (state >= 0 && state < MASK_STATE_COUNT) ? m_mask[state] : 0;
+}
+
+swsl::Profile::Counter swsl::Profile::GetRunCount( void ) const
+{
+	return m_runs;
+}
+
+swsl::Profile::Counter swsl::Profile::GetBlockCount( void ) const
+{
+	return m_blocks;
+}
+
+double swsl::Profile::GetSeconds( void ) const
+{
+	return m_nanoseconds * 1.0e-9;
+}
+
+// Human readable summary, instructions that were executed are listed by count, most frequent first
+void swsl::Profile::WriteText(std::ostream &out) const
+{
+	const Counter total  = GetInstructionCount();
+	const double  blocks = m_blocks > 0 ? (double)m_blocks : 1.0;
+
+	out << "runs " << m_runs << ", blocks " << m_blocks << ", " << GetSeconds() * 1000.0 << " ms";
+	out << " (" << m_nanoseconds / blocks << " ns per block)\n";
+	out << "mask";
+	for (int i = 0; i < MASK_STATE_COUNT; ++i) {
+		out << (i > 0 ? ", " : " ") << GetMaskName((MaskState)i) << " " << Percent(m_mask[i], total) << "%";
+	}
+	out << "\n";
+	out << "instructions " << total << " (" << total / blocks << " per block)\n";
+
+	bool listed[INSTR_COUNT];
+	for (int i = 0; i < INSTR_COUNT; ++i) { listed[i] = m_instr[i] == 0; }
+	for (;;) {
+		int next = -1;
+		for (int i = 0; i < INSTR_COUNT; ++i) {
+			if (!listed[i] && (next < 0 || m_instr[i] > m_instr[next])) { next = i; }
+		}
+		if (next < 0) { break; }
+		listed[next] = true;
+		out << "\t";
+		PrintName(gInstr[next].name, out);
+		for (int pad = gInstr[next].name.GetSize(); pad < 16; ++pad) { out << " "; }
+		out << m_instr[next] << "\t" << Percent(m_instr[next], total) << "%\n";
+	}
+}
+
+// Every instruction is listed, including those never executed, so reports can be compared key by key
+void swsl::Profile::WriteJson(std::ostream &out) const
+{
+	out << "{\n";
+	out << "\t\"runs\" : " << m_runs << ",\n";
+	out << "\t\"blocks\" : " << m_blocks << ",\n";
+	out << "\t\"seconds\" : " << GetSeconds() << ",\n";
+	out << "\t\"mask\" : {\n";
+	for (int i = 0; i < MASK_STATE_COUNT; ++i) {
+		out << "\t\t\"" << GetMaskName((MaskState)i) << "\" : " << m_mask[i] << (i < MASK_STATE_COUNT - 1 ? ",\n" : "\n");
+	}
+	out << "\t},\n";
+	out << "\t\"instructions\" : {\n";
+	for (int i = 0; i < INSTR_COUNT; ++i) {
+		out << "\t\t\"";
+		PrintName(gInstr[i].name, out);
+		out << "\" : " << m_instr[i] << (i < INSTR_COUNT - 1 ? ",\n" : "\n");
+	}
+	out << "\t}\n";
+	out << "}\n";
+}
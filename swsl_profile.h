@@ -0,0 +1,70 @@
+#ifndef SWSL_PROFILE_H_INCLUDED__
+#define SWSL_PROFILE_H_INCLUDED__
+
+#include <ostream>
+
+#include "swsl_instr.h"
+
+// Profiling is compiled into the VM only when SWSL_PROFILE is defined as 1. Otherwise execution contexts
+// hold no profile and the VM functions take no profile argument, SWSL_PROFILE_ARG(x) expands to nothing.
+#ifndef SWSL_PROFILE
+	#define SWSL_PROFILE 0
+#endif
+
+#if SWSL_PROFILE
+	#define SWSL_PROFILE_ARG(x) , x
+#else
+	#define SWSL_PROFILE_ARG(x)
+#endif
+
+namespace swsl
+{
+
+	// Execution statistics collected by the VM. Instructions are counted once per block of MPL_WIDTH
+	// fragments. The active mask (the conditional mask combined with the coverage of the block) is
+	// sampled before every instruction. Profiling builds always interpret, JIT code is not instrumented.
+	class Profile
+	{
+	public:
+		enum MaskState
+		{
+			MASK_ALL_PASS,
+			MASK_MIXED,
+			MASK_ALL_FAIL,
+			MASK_STATE_COUNT
+		};
+
+		typedef unsigned long long Counter;
+
+	private:
+		Counter m_instr[INSTR_COUNT];
+		Counter m_mask[MASK_STATE_COUNT];
+		Counter m_runs;        // calls to RunBatch
+		Counter m_blocks;      // program executions
+		Counter m_nanoseconds; // time spent in RunBatch
+
+	private:
+		static const char *GetMaskName(MaskState state);
+
+	public:
+		Profile( void );
+
+		void    Reset( void );
+		void    Merge(const Profile &profile);
+		Counter GetInstructionCount(InstructionSet instr) const;
+		Counter GetInstructionCount( void ) const;
+		Counter GetMaskCount(MaskState state) const;
+		Counter GetRunCount( void ) const;
+		Counter GetBlockCount( void ) const;
+		double  GetSeconds( void ) const;
+		void    WriteText(std::ostream &out) const;
+		void    WriteJson(std::ostream &out) const;
+
+		// Called by the VM
+		void CountInstruction(InstructionSet instr, MaskState mask) { ++m_instr[instr]; ++m_mask[mask]; }
+		void CountRun(int blocks, Counter nanoseconds) { ++m_runs; m_blocks += blocks; m_nanoseconds += nanoseconds; }
+	};
+
+}
+
+#endif // SWSL_PROFILE_H_INCLUDED__
@@ -0,0 +1,94 @@
+#include "swsl_program.h"
+#include "swsl_image.h"
+
+#include "MiniLib/MTL/mtlArray.h"
+#include "MiniLib/MTL/mtlMemory.h"
+
+swsl::ProgramVM::ProgramVM( void ) : m_shader(), m_program(&m_shader), m_context(), m_constants(0), m_varyings(0), m_fragments(0), m_varying_offset(-1), m_constant_offset(-1)
+{}
+
+// Copies run the program of the VM they were copied from, which has to outlive them, in an execution context of
+// their own, so each thread can shade with a copy at the same time
+swsl::ProgramVM::ProgramVM(const ProgramVM &vm) : m_shader(), m_program(vm.m_program), m_context(), m_constants(vm.m_constants), m_varyings(vm.m_varyings), m_fragments(vm.m_fragments), m_varying_offset(vm.m_varying_offset), m_constant_offset(vm.m_constant_offset)
+{
+	if (vm.m_context.GetShader() != NULL) {
+		m_context.SetShader(*m_program);
+	}
+}
+
+// The binary is an image as written by Image::Write. It is copied, so it does not need to outlive the VM.
+bool swsl::ProgramVM::SetProgram(const swsl::Binary &bin)
+{
+	m_constants = 0;
+	m_varyings  = 0;
+	m_fragments = 0;
+	m_varying_offset  = -1;
+	m_constant_offset = -1;
+	m_program = &m_shader;
+	m_shader.Delete();
+
+	// Images are read in place and need word alignment, which the characters of a binary do not guarantee
+	const int size = bin.GetSize();
+	mtlArray<unsigned int> words;
+	words.Create((size + (int)sizeof(unsigned int) - 1) / (int)sizeof(unsigned int) + 1);
+	mtlCopy((char*)&words[0], bin.GetChars(), size);
+
+	Image image;
+	if (!image.Load(&words[0], size)) { return false; }
+	const int entry = image.FindEntry("main");
+	m_shader.SetImage(image, entry >= 0 ? entry : 0);
+	if (m_shader.GetErrorCount() > 0) { return false; }
+
+	m_constants = (int)image.GetHeader()->constants;
+	m_varyings  = (int)image.GetHeader()->varyings;
+	m_fragments = (int)image.GetHeader()->fragments;
+	m_context.SetShader(m_shader);
+	return true;
+}
+
+// The layout of the data the VM is called with, as many fragment components per pixel as the pixel stride of the
+// frame buffer followed by the given number of varyings and constants. Fails if the program reads past any of them.
+bool swsl::ProgramVM::SetLayout(int pixel_stride, int varyings, int constants)
+{
+	if (!m_program->IsValid() || pixel_stride < m_fragments || varyings < m_varyings || constants < m_constants) {
+		m_varying_offset  = -1;
+		m_constant_offset = -1;
+		return false;
+	}
+	m_varying_offset  = pixel_stride;
+	m_constant_offset = pixel_stride + varyings;
+	return true;
+}
+
+// Copies share the shader of the original, so they can not change how it is dispatched
+void swsl::ProgramVM::SetDispatchMode(swsl::Shader::DispatchMode mode)
+{
+	if (m_program != &m_shader) { return; }
+	m_shader.SetDispatchMode(mode);
+}
+
+bool swsl::ProgramVM::IsValid( void ) const
+{
+	return m_program->IsValid() && m_varying_offset >= 0;
+}
+
+const swsl::Shader &swsl::ProgramVM::GetShader( void ) const
+{
+	return *m_program;
+}
+
+// Fragment components are only written where m0 is set, the rest of the data is left as it was
+bool swsl::ProgramVM::operator()(void *data, const mpl::wide_bool &m0)
+{
+	if (m_varying_offset < 0) { return false; }
+	mpl::wide_float *fragments = (mpl::wide_float*)data;
+	mpl::wide_float *varyings  = fragments + m_varying_offset;
+	mpl::wide_float *constants = fragments + m_constant_offset;
+	const Shader::InputArrays inputs = {
+		{ constants, m_constants },
+		{ varyings,  m_varyings },
+		{ fragments, m_fragments }
+	};
+	m_context.SetInputArrays(inputs);
+	return m_context.Run(m0);
+}
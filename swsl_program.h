@@ -4,18 +4,40 @@
 #include "MiniLib/MPL/mplWide.h"
 
 #include "swsl_instr.h"
+#include "swsl_shader.h"
 
 namespace swsl
 {
 
+// Runs a compiled program image with the calling convention of native shaders, so it can be given to
+// rasterizer::fill_triangle in place of one. The data is laid out flat as in the native rasterizer:
+// fragment components first, followed by the varyings and then the constants. The layout belongs to the caller
+// and is given with SetLayout once the program is loaded, the VM does not run without one that fits the program.
 class ProgramVM
 {
 private:
+	Shader           m_shader;
+	const Shader    *m_program; // m_shader, or the shader of the VM this one was copied from
+	ExecutionContext m_context;
+	int              m_constants;
+	int              m_varyings;
+	int              m_fragments;
+	int              m_varying_offset;  // in the data passed to the call operator, negative when there is no layout
+	int              m_constant_offset;
 
+private:
+	ProgramVM &operator=(const ProgramVM&) { return *this; }
 
 public:
-	bool SetProgram(const swsl::Binary &bin);
-	bool operator()(void *data, const mpl::wide_bool &m0);
+	ProgramVM( void );
+	ProgramVM(const ProgramVM &vm);
+
+	bool          SetProgram(const swsl::Binary &bin);
+	bool          SetLayout(int pixel_stride, int varyings, int constants);
+	void          SetDispatchMode(Shader::DispatchMode mode);
+	bool          IsValid( void ) const;
+	const Shader &GetShader( void ) const;
+	bool          operator()(void *data, const mpl::wide_bool &m0);
 };
 
 }
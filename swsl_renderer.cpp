@@ -0,0 +1,70 @@
+#include "swsl_renderer.h"
+
+static swsl::Renderer *CreateIsaRenderer( void )
+{
+	return new swsl::IsaRenderer;
+}
+
+// Makes the build available to CreateRenderer before main runs
+static const bool gRegistered = swsl::RegisterRenderer(SWSL_ISA, CreateIsaRenderer);
+
+swsl::IsaRenderer::IsaRenderer( void ) : m_shader(), m_rasterizer()
+{
+	m_rasterizer.SetShader(&m_shader);
+}
+
+swsl::Isa swsl::IsaRenderer::GetIsa( void ) const
+{
+	return SWSL_ISA;
+}
+
+int swsl::IsaRenderer::GetWidth( void ) const
+{
+	return MPL_WIDTH;
+}
+
+void swsl::IsaRenderer::SetProgram(const swsl::Instruction *program, int size)
+{
+	m_rasterizer.Flush();
+	m_shader.SetProgram(program, size);
+}
+
+bool swsl::IsaRenderer::IsValid( void ) const
+{
+	return m_shader.IsValid();
+}
+
+void swsl::IsaRenderer::SetThreadCount(int count)
+{
+	m_rasterizer.SetThreadCount(count);
+}
+
+void swsl::IsaRenderer::CreateBuffers(int width, int height, int components)
+{
+	m_rasterizer.CreateBuffers(width, height, components);
+}
+
+void swsl::IsaRenderer::SetDepthComponent(int component)
+{
+	m_rasterizer.SetDepthComponent(component);
+}
+
+void swsl::IsaRenderer::ClearBuffers( void )
+{
+	m_rasterizer.ClearBuffers();
+}
+
+void swsl::IsaRenderer::FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const float *attr, int var, int cnst)
+{
+	m_rasterizer.FillTriangle(a, b, c, attr, var, cnst);
+}
+
+void swsl::IsaRenderer::Flush( void )
+{
+	m_rasterizer.Flush();
+}
+
+void swsl::IsaRenderer::WriteColorBuffer(mtlByte *dst_pixels, int dst_bytes_per_pixel, mglByteOrder32 dst_byte_order)
+{
+	m_rasterizer.WriteColorBuffer(dst_pixels, dst_bytes_per_pixel, dst_byte_order);
+}
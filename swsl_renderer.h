@@ -0,0 +1,65 @@
+#ifndef SWSL_RENDERER_H_INCLUDED__
+#define SWSL_RENDERER_H_INCLUDED__
+
+#include "MiniLib/MGL/mglPixel.h"
+
+#include "swsl_gfx.h"
+#include "swsl_isa.h"
+#include "swsl_shader.h"
+
+namespace swsl
+{
+
+// The interface to the engine of one instruction set. Nothing in it depends on the SIMD width, so code built
+// for the baseline can drive any build through it, see CreateRenderer in swsl_isa.h.
+class Renderer
+{
+public:
+	virtual ~Renderer( void ) {}
+
+	virtual Isa  GetIsa( void ) const = 0;
+	virtual int  GetWidth( void ) const = 0; // fragments per block
+	virtual void SetProgram(const swsl::Instruction *program, int size) = 0;
+	virtual bool IsValid( void ) const = 0;
+	virtual void SetThreadCount(int count) = 0;
+	virtual void CreateBuffers(int width, int height, int components) = 0;
+	virtual void SetDepthComponent(int component) = 0;
+	virtual void ClearBuffers( void ) = 0;
+	virtual void FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const float *attr, int var, int cnst) = 0;
+	virtual void Flush( void ) = 0;
+	virtual void WriteColorBuffer(mtlByte *dst_pixels, int dst_bytes_per_pixel, mglByteOrder32 dst_byte_order) = 0;
+};
+
+SWSL_ISA_BEGIN
+
+// The Renderer of the build it is compiled into, a Shader drawn by a Rasterizer
+class IsaRenderer : public Renderer
+{
+private:
+	swsl::Shader     m_shader;
+	swsl::Rasterizer m_rasterizer;
+
+private:
+	IsaRenderer(const IsaRenderer&) {}
+	IsaRenderer &operator=(const IsaRenderer&) { return *this; }
+
+public:
+	IsaRenderer( void );
+
+	Isa  GetIsa( void ) const;
+	int  GetWidth( void ) const;
+	void SetProgram(const swsl::Instruction *program, int size);
+	bool IsValid( void ) const;
+	void SetThreadCount(int count);
+	void CreateBuffers(int width, int height, int components);
+	void SetDepthComponent(int component);
+	void ClearBuffers( void );
+	void FillTriangle(const swsl::Point3D &a, const swsl::Point3D &b, const swsl::Point3D &c, const float *attr, int var, int cnst);
+	void Flush( void );
+	void WriteColorBuffer(mtlByte *dst_pixels, int dst_bytes_per_pixel, mglByteOrder32 dst_byte_order);
+};
+
+SWSL_ISA_END
+}
+
+#endif // SWSL_RENDERER_H_INCLUDED__
@@ -1,25 +1,427 @@
+#include <stdint.h>
+
 #include "swsl_shader.h"
 #include "swsl_instr.h"
+#include "swsl_optimize.h"
+#include "swsl_image.h"
 
 #include "MiniLib/MTL/mtlMemory.h"
+#include "MiniLib/MML/mmlMath.h"
+
+#if SWSL_PROFILE
+	#include <chrono>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+	#define SWSL_THREADED_DISPATCH 1
+#else
+	#define SWSL_THREADED_DISPATCH 0
+#endif
+
+// Handler labels and dispatch. The switch loop is always present, threaded dispatch jumps directly between the handler labels.
+#if SWSL_THREADED_DISPATCH
+	#define vm_op(X)       case swsl::X: X##_handler:
+	#define vm_dispatch    if (threaded) { vm_sample; goto *dispatch[op->instr]; } break
+#else
+	#define vm_op(X)       case swsl::X:
+	#define vm_dispatch    break
+#endif
+#define vm_next            ++op; vm_dispatch
+
+// Samples the instruction about to be dispatched, placed wherever the VM dispatches.
+#if SWSL_PROFILE
+	#define vm_sample      profile.CountInstruction(op->instr, GetMaskState(mask_reg & block->mask))
+#else
+	#define vm_sample
+#endif
+
+// Operands of the current decoded instruction.
+#define reg_a              (*(base[op->seg_a] + op->a))
+#define reg_b              (*(base[op->seg_b] + op->b))
+#define reg_c              (*(base[op->seg_c] + op->c))
+#define imm_b              (*(pool + op->b))
+
+// Integer and boolean views of the same operands.
+#define int_a              (*(mpl::wide_int*)&reg_a)
+#define int_b              (*(mpl::wide_int*)&reg_b)
+#define int_imm_b          (*(const mpl::wide_int*)&imm_b)
+#define bool_a             (*(mpl::wide_bool*)&reg_a)
+#define bool_b             (*(mpl::wide_bool*)&reg_b)
+
+// Scratch frames are owned by the calling thread and reused between calls.
+static mpl::wide_float *GetThreadFrame(int size)
+{
+	static thread_local mtlArray<mpl::wide_float> frame;
+	if (frame.GetSize() < size || frame.GetSize() == 0) {
+		frame.Create(mmlMax(size, 1));
+	}
+	return &frame[0];
+}
+
+#if SWSL_PROFILE
+static swsl::Profile::MaskState GetMaskState(const mpl::wide_bool &mask)
+{
+	if (mask.all_fail())    { return swsl::Profile::MASK_ALL_FAIL; }
+	if ((!mask).all_fail()) { return swsl::Profile::MASK_ALL_PASS; }
+	return swsl::Profile::MASK_MIXED;
+}
+#endif
+
+swsl::Shader::Shader( void ) : m_entry(0), m_frame_size(0), m_mask_depth(0), m_from_image(false), m_dispatch(DISPATCH_THREADED), m_jit_compiled(false), m_inputs(NULL)
+{
+	for (int i = 0; i < SEG_COUNT; ++i) {
+		m_segment_size[i]   = 0;
+		m_segment_offset[i] = -1;
+	}
+	SetDispatchMode(DISPATCH_THREADED);
+}
+
+void swsl::Shader::AddError(const mtlChars &msg, int iptr)
+{
+	m_errors.AddLast();
+	m_errors.GetLast()->GetItem().msg.Copy(msg);
+	m_errors.GetLast()->GetItem().ref.FromInt(iptr);
+}
+
+void swsl::Shader::MapSlot(addr_t slot, unsigned char &seg, addr_t &offset) const
+{
+	int s = (int)slot;
+	for (int i = 0; i < SEG_LOCAL; ++i) {
+		if (s < m_segment_size[i]) {
+			seg    = (unsigned char)i;
+			offset = (addr_t)s;
+			return;
+		}
+		s -= m_segment_size[i];
+	}
+	seg    = SEG_LOCAL;
+	offset = (addr_t)s;
+}
+
+// Vector operands must not run from one input segment into the next
+bool swsl::Shader::IsInSegment(unsigned char seg, addr_t offset, int width) const
+{
+	return seg == SEG_LOCAL || (int)offset + width <= m_segment_size[seg];
+}
+
+bool swsl::Shader::Decode( void )
+{
+	m_jit.Free();
+	m_jit_compiled = false;
+	const int size = m_program.GetSize();
+	if (size < gMetaData_Size) {
+		AddError("[Decode] Missing meta data", 0);
+		return false;
+	}
+
+	// Map instruction stream indices to decoded instruction indices
+	mtlArray<int> op_index, op_offset;
+	op_index.Create(size);
+	op_offset.Create(size + 1);
+	int count = 0;
+	for (int i = 0; i < size; ++i) { op_index[i] = -1; }
+	for (int iptr = gMetaData_Size; iptr < size; ) {
+		const int instr = (int)m_program[iptr].instr;
+		if (instr < 0 || instr >= INSTR_COUNT) {
+			AddError("[Decode] Unknown instruction", iptr);
+			return false;
+		}
+		op_offset[count] = iptr;
+		op_index[iptr]   = count++;
+		iptr += 1 + gInstr[instr].params;
+		if (iptr > size) {
+			AddError("[Decode] Truncated instruction", size);
+			return false;
+		}
+	}
+
+	const int entry = m_program[gMetaData_EntryIndex].u_addr;
+	if (entry >= size || op_index[entry] < 0) {
+		AddError("[Decode] Entry point is not an instruction", entry);
+		return false;
+	}
+	m_entry = op_index[entry];
+
+	// Track which parts of the input the program reads and writes
+	mtlArray<char> frag_loads, frag_stores;
+	frag_loads.Create(mmlMax(m_segment_size[SEG_FRAGMENT], 1));
+	frag_stores.Create(mmlMax(m_segment_size[SEG_FRAGMENT], 1));
+	for (int i = 0; i < m_segment_size[SEG_FRAGMENT]; ++i) {
+		frag_loads[i]  = 0;
+		frag_stores[i] = 0;
+	}
+	bool stores_constant = false;
+	bool stores_varying  = false;
+
+	// Immediates are deduplicated and broadcast once instead of on every execution
+	mtlArray<float> constants;
+	constants.Create(mmlMax(count, 1));
+	int constant_count = 0;
 
-// Points to an instruction in the instruction cache.
-#define read_1_instr(reg) reg = &program[iptr++]
-#define read_2_instr(reg_a, reg_b) read_1_instr(reg_a); read_1_instr(reg_b)
+	// One extra instruction terminates programs that run past the end of the stream
+	m_code.Create(count + 1);
+	op_offset[count] = size;
+	int local_count = 0;
 
-// Convert an instruction pointer to a value, or dereference the pointer to a value stored in the data cache.
-#define to_wide_float(reg)       (mpl::wide_float(*(float*)(reg)))
+	for (int iptr = gMetaData_Size, n = 0; iptr < size; ++n) {
+		const InstructionSet instr = m_program[iptr].instr;
+		Op &op = m_code[n];
+		op.instr = instr;
+		op.a     = 0;
+		op.b     = 0;
+		op.c     = 0;
+		op.seg_a = SEG_LOCAL;
+		op.seg_b = SEG_LOCAL;
+		op.seg_c = SEG_LOCAL;
+		op.depth = MASK_UNREACHABLE;
+
+		if (IsJump(instr)) {
+			const int target = m_program[iptr + 1].u_addr;
+			if (target >= size || op_index[target] < 0) {
+				AddError("[Decode] Jump target is not an instruction", iptr);
+				return false;
+			}
+			op.b = (addr_t)op_index[target];
+		} else if (gInstr[instr].params >= 1) {
+			MapSlot(m_program[iptr + 1].u_addr, op.seg_a, op.a);
+			if (!IsInSegment(op.seg_a, op.a, OperandSlots(instr, 0))) {
+				AddError("[Decode] Vector operand crosses an input segment", iptr + 1);
+				return false;
+			}
+			if (gInstr[instr].params >= 2) {
+				if (IsCountOperand(instr)) {
+					op.c = m_program[iptr + 2].u_addr;
+					if (op.c >= 32) {
+						AddError("[Decode] Shift count out of range", iptr + 2);
+						return false;
+					}
+				} else if ((SWSL_INSTR_IMM_PARAM2(instr) || instr == FLT_MSET_MI) && m_from_image) {
+					op.b = m_program[iptr + 2].u_addr;
+					if (op.b >= m_image_pool.GetSize()) {
+						AddError("[Decode] Constant pool index out of range", iptr + 2);
+						return false;
+					}
+				} else if (SWSL_INSTR_IMM_PARAM2(instr) || instr == FLT_MSET_MI) {
+					const float imm = m_program[iptr + 2].fl_imm;
+					int index = 0;
+					while (index < constant_count && !IsSameConstant(constants[index], imm)) { ++index; }
+					if (index == constant_count) { constants[constant_count++] = imm; }
+					op.b = (addr_t)index;
+				} else {
+					const int width = OperandSlots(instr, 1);
+					MapSlot(m_program[iptr + 2].u_addr, op.seg_b, op.b);
+					if (!IsInSegment(op.seg_b, op.b, width)) {
+						AddError("[Decode] Vector operand crosses an input segment", iptr + 2);
+						return false;
+					}
+					if (op.seg_b == SEG_FRAGMENT) { for (int i = 0; i < width; ++i) { frag_loads[op.b + i] = 1; } }
+					if (op.seg_b == SEG_LOCAL) { local_count = mmlMax(local_count, (int)op.b + width); }
+				}
+			}
+			if (gInstr[instr].params == 3) {
+				const int width = OperandSlots(instr, 2);
+				MapSlot(m_program[iptr + 3].u_addr, op.seg_c, op.c);
+				if (!IsInSegment(op.seg_c, op.c, width)) {
+					AddError("[Decode] Vector operand crosses an input segment", iptr + 3);
+					return false;
+				}
+				if (op.seg_c == SEG_FRAGMENT) { for (int i = 0; i < width; ++i) { frag_loads[op.c + i] = 1; } }
+				if (op.seg_c == SEG_LOCAL) { local_count = mmlMax(local_count, (int)op.c + width); }
+			}
+			const int dst_width = OperandSlots(instr, 0);
+			switch (op.seg_a) {
+			case SEG_CONSTANT: stores_constant = stores_constant || WritesDestination(instr); break;
+			case SEG_VARYING:  stores_varying  = stores_varying  || WritesDestination(instr); break;
+			case SEG_FRAGMENT:
+				// Writes may be masked or skipped by a jump, so written components are loaded as well
+				for (int i = 0; i < dst_width; ++i) {
+					frag_loads[op.a + i] = 1;
+					if (WritesDestination(instr)) { frag_stores[op.a + i] = 1; }
+				}
+				break;
+			default:
+				local_count = mmlMax(local_count, (int)op.a + dst_width);
+				break;
+			}
+		}
+		iptr += 1 + gInstr[instr].params;
+	}
+	m_code[count].instr = INSTR_COUNT;
+	m_code[count].a     = 0;
+	m_code[count].b     = 0;
+	m_code[count].c     = 0;
+	m_code[count].seg_a = SEG_LOCAL;
+	m_code[count].seg_b = SEG_LOCAL;
+	m_code[count].seg_c = SEG_LOCAL;
+	m_code[count].depth = MASK_UNREACHABLE;
+
+	if (!Verify(op_offset)) {
+		return false;
+	}
+
+	// Frame layout: locals, fragment output, inputs the program writes to, saved masks
+	m_segment_size[SEG_LOCAL]     = local_count;
+	m_segment_offset[SEG_LOCAL]   = 0;
+	m_segment_offset[SEG_FRAGMENT] = local_count;
+	m_frame_size = local_count + m_segment_size[SEG_FRAGMENT];
+	m_segment_offset[SEG_CONSTANT] = stores_constant ? m_frame_size : -1;
+	m_frame_size += stores_constant ? m_segment_size[SEG_CONSTANT] : 0;
+	m_segment_offset[SEG_VARYING] = stores_varying ? m_frame_size : -1;
+	m_frame_size += stores_varying ? m_segment_size[SEG_VARYING] : 0;
+
+	int load_count = 0, store_count = 0;
+	for (int i = 0; i < m_segment_size[SEG_FRAGMENT]; ++i) {
+		load_count  += frag_loads[i];
+		store_count += frag_stores[i];
+	}
+	m_frag_loads.Create(load_count);
+	m_frag_stores.Create(store_count);
+	for (int i = 0, l = 0, s = 0; i < m_segment_size[SEG_FRAGMENT]; ++i) {
+		if (frag_loads[i] != 0)  { m_frag_loads[l++]  = (addr_t)i; }
+		if (frag_stores[i] != 0) { m_frag_stores[s++] = (addr_t)i; }
+	}
+
+	if (m_frame_size + m_mask_depth > STACK_SIZE) {
+		AddError("[Decode] Program exceeds maximum stack size", m_frame_size + m_mask_depth);
+		return false;
+	}
+	m_program[gMetaData_StackIndex].u_addr = (addr_t)(m_frame_size + m_mask_depth);
+
+	if (m_from_image) {
+		m_pool.Create(m_image_pool.GetSize());
+		for (int i = 0; i < m_image_pool.GetSize(); ++i) {
+			m_pool[i] = mpl::wide_float(m_image_pool[i]);
+		}
+	} else {
+		m_pool.Create(constant_count);
+		for (int i = 0; i < constant_count; ++i) {
+			m_pool[i] = mpl::wide_float(constants[i]);
+		}
+	}
+
+	if (m_dispatch == DISPATCH_JIT) {
+		CompileJit();
+	}
+	return true;
+}
+
+// Native code is only generated for shaders set to DISPATCH_JIT, at most once per decode.
+// Programs the native code generator rejects still run on the interpreter.
+void swsl::Shader::CompileJit( void )
+{
+	if (m_jit_compiled || m_code.GetSize() == 0) { return; }
+	m_jit_compiled = true;
+	JitCompiler().Compile(*this, m_jit);
+}
+
+// Follows every path from the entry point. Mask stack depths must agree wherever paths meet,
+// never drop below zero and be back to zero when the program ends. Verified programs run without
+// bounds checks: jump targets, operands and stack accesses are all known to be in range.
+bool swsl::Shader::Verify(const mtlArray<int> &op_offset)
+{
+	const int count  = m_code.GetSize() - 1;
+	const int inputs = m_segment_size[SEG_CONSTANT] + m_segment_size[SEG_VARYING] + m_segment_size[SEG_FRAGMENT];
+	if (inputs > 0 && inputs != (int)m_program[gMetaData_InputIndex].u_addr) {
+		AddError("[Verify] Input layout does not match program input count", gMetaData_InputIndex);
+		return false;
+	}
+
+	mtlArray<int> work;
+	work.Create(count + 1);
+	int top = 0;
+	m_mask_depth = 0;
+	m_code[m_entry].depth = 0;
+	work[top++] = m_entry;
+	while (top > 0) {
+		const int i       = work[--top];
+		const Op &op      = m_code[i];
+		int       d       = op.depth;
+		int       succ[2] = { i + 1, -1 };
+		switch (op.instr) {
+		case TST_PUSH:
+			m_mask_depth = mmlMax(m_mask_depth, ++d);
+			break;
+		case TST_POP:
+			if (--d < 0) {
+				AddError("[Verify] Mask stack underflow", op_offset[i]);
+				return false;
+			}
+			break;
+		case END:
+		case RETURN:
+			if (d != 0) {
+				AddError("[Verify] Mask stack not empty at end of program", op_offset[i]);
+				return false;
+			}
+			succ[0] = -1;
+			break;
+		case TST_RETURN:
+			AddError("[Verify] Conditional return is not supported", op_offset[i]);
+			return false;
+		case INSTR_COUNT:
+			AddError("[Verify] Program runs past the end of the instruction stream", op_offset[i]);
+			return false;
+		case UNS_JMP_I:
+			succ[0] = op.b;
+			break;
+		case TST_JMP_FAIL_I:
+		case TST_JMP_PASS_I:
+			succ[1] = op.b;
+			break;
+		default:
+			break;
+		}
+		for (int s = 0; s < 2; ++s) {
+			if (succ[s] < 0) { continue; }
+			Op &next = m_code[succ[s]];
+			if (next.depth == MASK_UNREACHABLE) {
+				next.depth = (addr_t)d;
+				work[top++] = succ[s];
+			} else if ((int)next.depth != d) {
+				AddError("[Verify] Mask stack depth differs between paths", op_offset[succ[s]]);
+				return false;
+			}
+		}
+	}
+	return true;
+}
 
 void swsl::Shader::Delete( void )
 {
 	m_program.Free();
+	m_code.Free();
+	m_entry = 0;
+	m_frame_size = 0;
+	m_mask_depth = 0;
+	m_frag_loads.Free();
+	m_frag_stores.Free();
+	m_pool.Free();
+	m_image_pool.Free();
+	m_from_image = false;
+	m_jit.Free();
+	m_jit_compiled = false;
 	m_errors.RemoveAll();
 	m_warnings.RemoveAll();
 }
 
 bool swsl::Shader::IsValid( void ) const
 {
-	return m_program.GetSize() > 0 && m_errors.GetSize() == 0 && (m_inputs->constant.count + m_inputs->varying.count + m_inputs->fragments.count == m_program[gMetaData_InputIndex].u_addr);
+	return m_program.GetSize() > 0 && m_code.GetSize() > 0 && m_errors.GetSize() == 0 && (m_inputs == NULL || IsCompatible(*m_inputs));
+}
+
+bool swsl::Shader::IsCompatible(const InputArrays &inputs) const
+{
+	return
+		m_program.GetSize() > 0 &&
+		(inputs.constant.count + inputs.varying.count + inputs.fragments.count == m_program[gMetaData_InputIndex].u_addr) &&
+		inputs.constant.count == m_segment_size[SEG_CONSTANT] &&
+		inputs.varying.count == m_segment_size[SEG_VARYING] &&
+		inputs.fragments.count == m_segment_size[SEG_FRAGMENT];
+}
+
+int swsl::Shader::GetStackSize( void ) const
+{
+	return m_program.GetSize() > 0 ? (int)m_program[gMetaData_StackIndex].u_addr : 0;
 }
 
 int swsl::Shader::GetErrorCount( void ) const
@@ -32,9 +434,135 @@ int swsl::Shader::GetWarningCount( void ) const
 	return m_warnings.GetSize();
 }
 
+void swsl::Shader::SetProgram(const swsl::Instruction *program, int size)
+{
+	Delete();
+	m_program.Create(size);
+	mtlCopy(&m_program[0], program, size);
+	Optimizer().Optimize(m_program);
+	if (!Decode()) {
+		m_program.Free();
+		m_code.Free();
+	}
+}
+
+// Images hold optimized programs with a prebuilt constant pool, so they are only decoded and verified
+void swsl::Shader::SetImage(const swsl::Image &image, int entry)
+{
+	Delete();
+	if (!image.IsValid() || entry < 0 || entry >= image.GetEntryCount()) {
+		AddError("[SetImage] Invalid image or entry point", entry);
+		return;
+	}
+	const ImageHeader *header = image.GetHeader();
+	m_program.Create(image.GetCodeSize());
+	mtlCopy(&m_program[0], image.GetCode(), image.GetCodeSize());
+	m_program[gMetaData_EntryIndex].u_addr = (addr_t)image.GetEntries()[entry].index;
+	m_image_pool.Create(image.GetPoolSize());
+	for (int i = 0; i < image.GetPoolSize(); ++i) {
+		m_image_pool[i] = image.GetPool()[i];
+	}
+	m_from_image = true;
+	m_segment_size[SEG_CONSTANT] = header->constants;
+	m_segment_size[SEG_VARYING]  = header->varyings;
+	m_segment_size[SEG_FRAGMENT] = header->fragments;
+	if (!Decode()) {
+		m_program.Free();
+		m_code.Free();
+	}
+}
+
+// The specialized shader has the same input layout but reads constants from immediates, so it is run with the same
+// input arrays. Constants must be the same in every lane.
+bool swsl::Shader::Specialize(const InputArray &constants, Shader &out) const
+{
+	if (&out == this) { return false; }
+	out.Delete();
+	if (m_program.GetSize() == 0 || m_errors.GetSize() > 0) {
+		out.AddError("[Specialize] Shader is not loaded", 0);
+		return false;
+	}
+	if (constants.count != m_segment_size[SEG_CONSTANT] || (constants.count > 0 && constants.data == NULL)) {
+		out.AddError("[Specialize] Constants do not match the input layout", constants.count);
+		return false;
+	}
+	mtlArray<float> values;
+	values.Create(mmlMax(constants.count, 1));
+	for (int i = 0; i < constants.count; ++i) {
+		float lanes[MPL_WIDTH];
+		constants.data[i].to_scalar(lanes);
+		for (int l = 1; l < MPL_WIDTH; ++l) {
+			if (!IsSameConstant(lanes[l], lanes[0])) {
+				out.AddError("[Specialize] Constant differs between lanes", i);
+				return false;
+			}
+		}
+		values[i] = lanes[0];
+	}
+
+	const int size = m_program.GetSize();
+	out.m_program.Create(size);
+	mtlCopy(&out.m_program[0], &m_program[0], size);
+	// Immediates of images are indices into their constant pool
+	if (m_from_image) {
+		for (int iptr = gMetaData_Size; iptr < size; iptr += 1 + gInstr[out.m_program[iptr].instr].params) {
+			const InstructionSet instr = out.m_program[iptr].instr;
+			if (SWSL_INSTR_IMM_PARAM2(instr) || instr == FLT_MSET_MI) {
+				out.m_program[iptr + 2].fl_imm = m_image_pool[out.m_program[iptr + 2].u_addr];
+			}
+		}
+	}
+	for (int i = 0; i < SEG_COUNT; ++i) {
+		out.m_segment_size[i] = m_segment_size[i];
+	}
+	out.m_dispatch = m_dispatch;
+	Optimizer().Specialize(out.m_program, &values[0], constants.count);
+	if (!out.Decode()) {
+		out.m_program.Free();
+		out.m_code.Free();
+		return false;
+	}
+	return true;
+}
+
+void swsl::Shader::SetDispatchMode(DispatchMode mode)
+{
+	if (mode == DISPATCH_JIT && !SWSL_JIT) {
+		mode = DISPATCH_THREADED;
+	}
+	m_dispatch = ((mode == DISPATCH_THREADED || mode == DISPATCH_JIT) && SWSL_THREADED_DISPATCH) ? mode : DISPATCH_SWITCH;
+	if (m_dispatch == DISPATCH_JIT) {
+		CompileJit();
+	}
+}
+
+swsl::Shader::DispatchMode swsl::Shader::GetDispatchMode( void ) const
+{
+	return m_dispatch;
+}
+
+// A layout the program can not run with only invalidates the decoded form, the program is kept so that the shader
+// recovers once it is given a layout that fits. Errors are those of the current layout.
+void swsl::Shader::SetInputLayout(int constants, int varyings, int fragments)
+{
+	if (constants == m_segment_size[SEG_CONSTANT] && varyings == m_segment_size[SEG_VARYING] && fragments == m_segment_size[SEG_FRAGMENT]) {
+		return;
+	}
+	m_segment_size[SEG_CONSTANT] = constants;
+	m_segment_size[SEG_VARYING]  = varyings;
+	m_segment_size[SEG_FRAGMENT] = fragments;
+	if (m_program.GetSize() > 0) {
+		m_errors.RemoveAll();
+		if (!Decode()) {
+			m_code.Free();
+		}
+	}
+}
+
 void swsl::Shader::SetInputArrays(InputArrays &inputs)
 {
 	m_inputs = &inputs;
+	SetInputLayout(inputs.constant.count, inputs.varying.count, inputs.fragments.count);
 }
 
 const mtlItem<swsl::CompilerMessage> *swsl::Shader::GetErrors( void ) const
@@ -61,242 +589,734 @@ void print_fl(const mpl::wide_float &f)
 
 bool swsl::Shader::Run(const mpl::wide_bool &frag_mask) const
 {
-	mpl::wide_float stack[STACK_SIZE];
+	if (m_inputs == NULL) { return false; }
+	Block block = { m_inputs->fragments.data, m_inputs->varying.data, frag_mask };
+	return RunBatch(&block, 1);
+}
 
-	swsl::addr_t   iptr = m_program[gMetaData_EntryIndex].u_addr; // instruction pointer
-	swsl::addr_t   sptr = 0;                                      // stack pointer
-	mpl::wide_bool mask_reg = true;                               // current conditional mask (state is pushed and popped from stack)
-	mpl::wide_bool test_reg;                                      // current test register
+// Inputs are addressed in place unless the program writes to them
+void swsl::Shader::InitBase(mpl::wide_float **base, mpl::wide_float *frame, const InputArrays &inputs) const
+{
+	base[SEG_LOCAL]    = frame;
+	base[SEG_FRAGMENT] = frame + m_segment_offset[SEG_FRAGMENT];
+	base[SEG_CONSTANT] = m_segment_offset[SEG_CONSTANT] < 0 ? inputs.constant.data : frame + m_segment_offset[SEG_CONSTANT];
+	base[SEG_VARYING]  = m_segment_offset[SEG_VARYING] < 0 ? NULL : frame + m_segment_offset[SEG_VARYING];
+}
 
-	const swsl::Instruction *program      = (const Instruction*)(&m_program[0]);
-	const swsl::addr_t       program_size = (addr_t)m_program.GetSize();
+void swsl::Shader::BindBlock(mpl::wide_float **base, const Block *block, const InputArrays &inputs) const
+{
+	if (m_segment_offset[SEG_CONSTANT] >= 0) {
+		mtlCopy(base[SEG_CONSTANT], inputs.constant.data, m_segment_size[SEG_CONSTANT]);
+	}
+	if (m_segment_offset[SEG_VARYING] >= 0) {
+		mtlCopy(base[SEG_VARYING], block->varying, m_segment_size[SEG_VARYING]);
+	} else {
+		base[SEG_VARYING] = const_cast<mpl::wide_float*>(block->varying);
+	}
+	// Only fragment components that are read need to be transferred
+	mpl::wide_float *fragment_data = base[SEG_FRAGMENT];
+	for (int i = 0; i < m_frag_loads.GetSize(); ++i) {
+		fragment_data[m_frag_loads[i]] = block->fragments[m_frag_loads[i]];
+	}
+}
 
-	void       *reg_a;
-	const void *reg_b;
+// Sync up fragment data that was written to output
+void swsl::Shader::MergeBlock(const mpl::wide_float *fragment_data, const Block *block) const
+{
+	for (int i = 0; i < m_frag_stores.GetSize(); ++i) {
+		const addr_t c = m_frag_stores[i];
+		block->fragments[c] = mpl::wide_float::mov_if_true(block->fragments[c], fragment_data[c], block->mask);
+	}
+}
 
-	// Transfer all data to local memory addressable by VM
-	int frag_offset = m_inputs->varying.count + m_inputs->constant.count;
-	mtlCopy(stack, m_inputs->constant.data, m_inputs->constant.count);
-	mtlCopy(stack + m_inputs->constant.count, m_inputs->varying.data, m_inputs->varying.count);
-	mtlCopy(stack + frag_offset, m_inputs->fragments.data, m_inputs->fragments.count);
+// Only runs through an ExecutionContext are profiled
+bool swsl::Shader::RunBatch(const Block *blocks, int count) const
+{
+	if (m_inputs == NULL) { return false; }
+#if SWSL_PROFILE
+	Profile profile;
+#endif
+	return RunFrame(*m_inputs, GetThreadFrame(GetStackSize()), blocks, count SWSL_PROFILE_ARG(profile));
+}
 
-	while (iptr < program_size) {
+// Nothing in the shader is written while running, all per run state lives in the frame and on the stack.
+// The profile belongs to the caller.
+bool swsl::Shader::RunFrame(const InputArrays &inputs, mpl::wide_float *frame, const Block *blocks, int count SWSL_PROFILE_ARG(Profile &profile)) const
+{
+	if (count <= 0) { return true; }
+#if SWSL_PROFILE
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const bool result = Dispatch(inputs, frame, blocks, count SWSL_PROFILE_ARG(profile));
+	profile.CountRun(count, (Profile::Counter)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	return result;
+#else
+	return Dispatch(inputs, frame, blocks, count);
+#endif
+}
 
-		switch (program[iptr++].instr) {
+// JIT code is not instrumented, profiling builds interpret it instead
+bool swsl::Shader::Dispatch(const InputArrays &inputs, mpl::wide_float *frame, const Block *blocks, int count SWSL_PROFILE_ARG(Profile &profile)) const
+{
+	if (m_dispatch == DISPATCH_JIT && m_jit.IsValid() && !SWSL_PROFILE) {
+		return ExecuteJit(inputs, frame, blocks, count);
+	}
+#if SWSL_THREADED_DISPATCH
+	if (m_dispatch != DISPATCH_SWITCH) {
+		return Execute<true>(inputs, frame, blocks, count SWSL_PROFILE_ARG(profile));
+	}
+#endif
+	return Execute<false>(inputs, frame, blocks, count SWSL_PROFILE_ARG(profile));
+}
 
-		case swsl::NOP:
-			continue;
+template < bool threaded >
+bool swsl::Shader::Execute(const InputArrays &inputs, mpl::wide_float *frame, const Block *blocks, int count SWSL_PROFILE_ARG(Profile &profile)) const
+{
+#if SWSL_THREADED_DISPATCH
+	// Must be kept in the same order as swsl::InstructionSet
+	static const void *const dispatch[INSTR_COUNT + 1] = {
+		&&NOP_handler,         &&END_handler,         &&RETURN_handler,      &&invalid_handler,
+		&&TST_PUSH_handler,    &&TST_POP_handler,     &&TST_AND_handler,     &&TST_OR_handler,      &&TST_INV_handler,
+		&&UNS_JMP_I_handler,   &&TST_JMP_FAIL_I_handler, &&TST_JMP_PASS_I_handler,
+		&&FLT_MSET_MM_handler, &&FLT_MSET_MI_handler,
+		&&FLT_SET_MM_handler,  &&FLT_SET_MI_handler,
+		&&FLT_ADD_MM_handler,  &&FLT_ADD_MI_handler,
+		&&FLT_SUB_MM_handler,  &&FLT_SUB_MI_handler,
+		&&FLT_MUL_MM_handler,  &&FLT_MUL_MI_handler,
+		&&FLT_DIV_MM_handler,  &&FLT_DIV_MI_handler,
+		&&FLT_EQ_MM_handler,   &&FLT_EQ_MI_handler,
+		&&FLT_NEQ_MM_handler,  &&FLT_NEQ_MI_handler,
+		&&FLT_LT_MM_handler,   &&FLT_LT_MI_handler,
+		&&FLT_LTE_MM_handler,  &&FLT_LTE_MI_handler,
+		&&FLT_GT_MM_handler,   &&FLT_GT_MI_handler,
+		&&FLT_GTE_MM_handler,  &&FLT_GTE_MI_handler,
+		&&FLT_ADD_MMM_handler, &&FLT_SUB_MMM_handler, &&FLT_MUL_MMM_handler, &&FLT_DIV_MMM_handler,
+		&&FLT_MAD_MMM_handler, &&FLT_MSUB_MMM_handler, &&FLT_LERP_MMM_handler,
+		&&TST_STORE_M_handler, &&TST_LOAD_M_handler,
+		&&INT_SET_MM_handler,  &&INT_SET_MI_handler,
+		&&INT_ADD_MM_handler,  &&INT_ADD_MI_handler,
+		&&INT_SUB_MM_handler,  &&INT_SUB_MI_handler,
+		&&INT_MUL_MM_handler,  &&INT_MUL_MI_handler,
+		&&INT_AND_MM_handler,  &&INT_AND_MI_handler,
+		&&INT_OR_MM_handler,   &&INT_OR_MI_handler,
+		&&INT_XOR_MM_handler,  &&INT_XOR_MI_handler,
+		&&INT_EQ_MM_handler,   &&INT_EQ_MI_handler,
+		&&INT_NEQ_MM_handler,  &&INT_NEQ_MI_handler,
+		&&INT_LT_MM_handler,   &&INT_LT_MI_handler,
+		&&INT_LTE_MM_handler,  &&INT_LTE_MI_handler,
+		&&INT_GT_MM_handler,   &&INT_GT_MI_handler,
+		&&INT_GTE_MM_handler,  &&INT_GTE_MI_handler,
+		&&INT_SHL_MC_handler,  &&INT_SHR_MC_handler,  &&INT_NEG_MM_handler,  &&INT_NOT_MM_handler,
+		&&BOOL_AND_MM_handler, &&BOOL_OR_MM_handler,  &&BOOL_XOR_MM_handler, &&BOOL_NOT_MM_handler,
+		&&INT_FLT_MM_handler,  &&FLT_INT_MM_handler,  &&INT_BOOL_MM_handler,
+		&&FLT_MIN_MM_handler,  &&FLT_MIN_MI_handler,
+		&&FLT_MAX_MM_handler,  &&FLT_MAX_MI_handler,
+		&&FLT_SQRT_MM_handler, &&FLT_RSQRT_MM_handler, &&FLT_ABS_MM_handler, &&FLT_FLOOR_MM_handler,
+		&&FLT_CLAMP_MMM_handler, &&FLT_DOT3_MMM_handler, &&FLT_NORM3_MM_handler,
+		&&invalid_handler
+	};
+#endif
 
-		case swsl::END: {
-			// Sync up fragment data to output
-			const mpl::wide_float *fragment_data = stack + frag_offset;
-			for (int i = 0; i < m_inputs->fragments.count; ++i) {
-				// NOTE: changed how CMOV works, cond_mask is now inverted
-				m_inputs->fragments.data[i] = mpl::wide_float::mov_if_true(fragment_data[i], m_inputs->fragments.data[i], frag_mask);
-			}
-			return true;
-		}
+	if (m_code.GetSize() == 0) { return false; }
 
-		case swsl::RETURN:
-			iptr = *((swsl::addr_t*)(&stack[sptr--]));
-			break;
+	mpl::wide_bool *mask_stack = (mpl::wide_bool*)(frame + m_frame_size); // saved conditional masks, frame is the register file
 
-		case swsl::TST_PUSH:
-			stack[sptr++] = *(mpl::wide_float*)(&mask_reg);
-			break;
+	const Op              *code  = &m_code[0];
+	const mpl::wide_float *pool  = m_pool.GetSize() > 0 ? &m_pool[0] : NULL; // pre-broadcast immediates
+	const Op              *op;                                               // instruction pointer
+	const Block           *block = blocks;                                   // current fragment block
+	const Block           *last  = blocks + count;
+	int                    mptr;                                             // mask stack pointer
+	mpl::wide_bool         mask_reg;                                         // current conditional mask (state is pushed and popped from mask stack)
+	mpl::wide_bool         test_reg;                                         // current test register
 
-		case swsl::TST_POP:
-			mask_reg = *(mpl::wide_bool*)(&stack[sptr--]);
-			break;
+	mpl::wide_float *base[SEG_COUNT];                                            // base registers
+	InitBase(base, frame, inputs);
+
+next_block:
+	BindBlock(base, block, inputs);
+	op       = code + m_entry;
+	mptr     = 0;
+	mask_reg = true;
 
-		case swsl::TST_AND:
+#if SWSL_THREADED_DISPATCH
+	if (threaded) { vm_sample; goto *dispatch[op->instr]; }
+#endif
+
+	for (;;) {
+
+		vm_sample;
+		switch (op->instr) {
+
+		vm_op(NOP)
+			vm_next;
+
+		vm_op(RETURN) // there is no call stack, returning from the entry point ends the program
+		vm_op(END) {
+			MergeBlock(base[SEG_FRAGMENT], block);
+			if (++block == last) { return true; }
+			goto next_block;
+		}
+
+		// Stack bounds are established by Verify
+		vm_op(TST_PUSH)
+			mask_stack[mptr++] = mask_reg;
+			vm_next;
+
+		vm_op(TST_POP)
+			mask_reg = mask_stack[--mptr];
+			vm_next;
+
+		vm_op(TST_AND)
 			mask_reg = mask_reg & test_reg;
-			break;
+			vm_next;
 
-		case swsl::TST_OR:
+		vm_op(TST_OR)
 			mask_reg = mask_reg | test_reg;
-			break;
+			vm_next;
 
-		case swsl::TST_INV:
+		vm_op(TST_INV)
 			mask_reg = !mask_reg;
-			break;
+			vm_next;
 
-		case swsl::FLT_PUSH_M:
-			stack[sptr] = stack[sptr - program[iptr++].u_addr];
-			++sptr;
-			break;
+		vm_op(UNS_JMP_I)
+			op = code + op->b;
+			vm_dispatch;
 
-		case swsl::FLT_PUSH_I:
-			stack[sptr++] = to_wide_float(program + iptr);
-			++iptr;
-			break;
+		// Fragments outside the block coverage do not keep a branch alive
+		vm_op(TST_JMP_FAIL_I)
+			if ((mask_reg & block->mask).all_fail()) {
+				op = code + op->b;
+				vm_dispatch;
+			}
+			vm_next;
 
-		case swsl::UNS_PUSH_I:
-			sptr += program[iptr++].u_addr;
-			break;
+		vm_op(TST_JMP_PASS_I)
+			if (!(mask_reg & block->mask).all_fail()) {
+				op = code + op->b;
+				vm_dispatch;
+			}
+			vm_next;
 
-		case swsl::FLT_POP_M: {
-			swsl::addr_t addr = sptr - program[iptr++].u_addr;
-			stack[addr] = stack[--sptr];
-			break;
-		}
+		vm_op(FLT_MSET_MM)
+			reg_a = mpl::wide_float::mov_if_true(reg_a, reg_b, mask_reg);
+			vm_next;
 
-		case swsl::UNS_POP_I:
-			sptr -= program[iptr++].u_addr;
-			break;
+		vm_op(FLT_MSET_MI)
+			reg_a = mpl::wide_float::mov_if_true(reg_a, imm_b, mask_reg);
+			vm_next;
 
-		case swsl::UNS_JMP_I:
-			iptr = program[iptr].u_addr;
-			++iptr;
-			break;
+		vm_op(FLT_SET_MM)
+			reg_a = reg_b;
+			vm_next;
 
-		case swsl::FLT_MSET_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			*(mpl::wide_float*)(reg_a) = *(mpl::wide_float*)(reg_b) & *(mpl::wide_float*)(&mask_reg);
-			break;
+		vm_op(FLT_SET_MI)
+			reg_a = imm_b;
+			vm_next;
 
-		case swsl::FLT_MSET_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			*(mpl::wide_float*)(reg_a) = *(mpl::wide_float*)(reg_b) & *(mpl::wide_float*)(&mask_reg);
-			break;
+		vm_op(FLT_ADD_MM)
+			reg_a += reg_b;
+			vm_next;
 
-		case swsl::FLT_SET_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			*(mpl::wide_float*)(reg_a) = *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_ADD_MI)
+			reg_a += imm_b;
+			vm_next;
 
-		case swsl::FLT_SET_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			*(mpl::wide_float*)(reg_a) = to_wide_float(reg_b);
-			break;
+		vm_op(FLT_SUB_MM)
+			reg_a -= reg_b;
+			vm_next;
 
-		case swsl::FLT_ADD_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			*(mpl::wide_float*)(reg_a) += *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_SUB_MI)
+			reg_a -= imm_b;
+			vm_next;
 
-		case swsl::FLT_ADD_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			*(mpl::wide_float*)(reg_a) += to_wide_float(reg_b);
-			break;
+		vm_op(FLT_MUL_MM)
+			reg_a *= reg_b;
+			vm_next;
 
-		case swsl::FLT_SUB_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			*(mpl::wide_float*)(reg_a) -= *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_MUL_MI)
+			reg_a *= imm_b;
+			vm_next;
 
-		case swsl::FLT_SUB_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			*(mpl::wide_float*)(reg_a) -= to_wide_float(reg_b);
-			break;
+		vm_op(FLT_DIV_MM)
+			reg_a /= reg_b;
+			vm_next;
 
-		case swsl::FLT_MUL_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			*(mpl::wide_float*)(reg_a) *= *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_DIV_MI)
+			reg_a /= imm_b;
+			vm_next;
 
-		case swsl::FLT_MUL_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			*(mpl::wide_float*)(reg_a) *= to_wide_float(reg_b);
-			break;
+		vm_op(FLT_EQ_MM)
+			test_reg = reg_a == reg_b;
+			vm_next;
 
-		case swsl::FLT_DIV_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			*(mpl::wide_float*)(reg_a) /= *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_EQ_MI)
+			test_reg = reg_a == imm_b;
+			vm_next;
 
-		case swsl::FLT_DIV_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			*(mpl::wide_float*)(reg_a) /= to_wide_float(reg_b);
-			break;
+		vm_op(FLT_NEQ_MM)
+			test_reg = reg_a != reg_b;
+			vm_next;
 
-		case swsl::FLT_EQ_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			test_reg = *(mpl::wide_float*)(reg_a) == *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_NEQ_MI)
+			test_reg = reg_a != imm_b;
+			vm_next;
 
-		case swsl::FLT_EQ_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			test_reg = *(mpl::wide_float*)(reg_a) == to_wide_float(reg_b);
-			break;
+		vm_op(FLT_LT_MM)
+			test_reg = reg_a < reg_b;
+			vm_next;
 
-		case swsl::FLT_NEQ_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			test_reg = *(mpl::wide_float*)(reg_a) != *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_LT_MI)
+			test_reg = reg_a < imm_b;
+			vm_next;
 
-		case swsl::FLT_NEQ_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			test_reg = *(mpl::wide_float*)(reg_a) != to_wide_float(reg_b);
-			break;
+		vm_op(FLT_LTE_MM)
+			test_reg = reg_a <= reg_b;
+			vm_next;
 
-		case swsl::FLT_LT_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			test_reg = *(mpl::wide_float*)(reg_a) < *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_LTE_MI)
+			test_reg = reg_a <= imm_b;
+			vm_next;
 
-		case swsl::FLT_LT_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			test_reg = *(mpl::wide_float*)(reg_a) < to_wide_float(reg_b);
-			break;
+		vm_op(FLT_GT_MM)
+			test_reg = reg_a > reg_b;
+			vm_next;
 
-		case swsl::FLT_LTE_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			test_reg = *(mpl::wide_float*)(reg_a) <= *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_GT_MI)
+			test_reg = reg_a > imm_b;
+			vm_next;
 
-		case swsl::FLT_LTE_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			test_reg = *(mpl::wide_float*)(reg_a) <= to_wide_float(reg_b);
-			break;
+		vm_op(FLT_GTE_MM)
+			test_reg = reg_a >= reg_b;
+			vm_next;
 
-		case swsl::FLT_GT_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			test_reg = *(mpl::wide_float*)(reg_a) > *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_GTE_MI)
+			test_reg = reg_a >= imm_b;
+			vm_next;
 
-		case swsl::FLT_GT_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			test_reg = *(mpl::wide_float*)(reg_a) > to_wide_float(reg_b);
-			break;
+		vm_op(FLT_ADD_MMM)
+			reg_a = reg_b + reg_c;
+			vm_next;
 
-		case swsl::FLT_GTE_MM:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = stack + sptr - program[iptr++].u_addr;
-			test_reg = *(mpl::wide_float*)(reg_a) >= *(mpl::wide_float*)(reg_b);
-			break;
+		vm_op(FLT_SUB_MMM)
+			reg_a = reg_b - reg_c;
+			vm_next;
 
-		case swsl::FLT_GTE_MI:
-			reg_a = stack + sptr - program[iptr++].u_addr;
-			reg_b = &program[iptr++];
-			test_reg = *(mpl::wide_float*)(reg_a) >= to_wide_float(reg_b);
-			break;
+		vm_op(FLT_MUL_MMM)
+			reg_a = reg_b * reg_c;
+			vm_next;
+
+		vm_op(FLT_DIV_MMM)
+			reg_a = reg_b / reg_c;
+			vm_next;
+
+		vm_op(FLT_MAD_MMM)
+			reg_a = reg_a * reg_b + reg_c;
+			vm_next;
+
+		vm_op(FLT_MSUB_MMM)
+			reg_a = reg_a * reg_b - reg_c;
+			vm_next;
+
+		vm_op(FLT_LERP_MMM)
+			reg_a += (reg_b - reg_a) * reg_c;
+			vm_next;
+
+		vm_op(TST_STORE_M)
+			bool_a = test_reg;
+			vm_next;
+
+		vm_op(TST_LOAD_M)
+			test_reg = bool_a;
+			vm_next;
+
+		vm_op(INT_SET_MM)
+			int_a = int_b;
+			vm_next;
+
+		vm_op(INT_SET_MI)
+			int_a = int_imm_b;
+			vm_next;
+
+		vm_op(INT_ADD_MM)
+			int_a += int_b;
+			vm_next;
+
+		vm_op(INT_ADD_MI)
+			int_a += int_imm_b;
+			vm_next;
+
+		vm_op(INT_SUB_MM)
+			int_a -= int_b;
+			vm_next;
+
+		vm_op(INT_SUB_MI)
+			int_a -= int_imm_b;
+			vm_next;
+
+		vm_op(INT_MUL_MM)
+			int_a *= int_b;
+			vm_next;
+
+		vm_op(INT_MUL_MI)
+			int_a *= int_imm_b;
+			vm_next;
+
+		vm_op(INT_AND_MM)
+			int_a &= int_b;
+			vm_next;
+
+		vm_op(INT_AND_MI)
+			int_a &= int_imm_b;
+			vm_next;
+
+		vm_op(INT_OR_MM)
+			int_a |= int_b;
+			vm_next;
+
+		vm_op(INT_OR_MI)
+			int_a |= int_imm_b;
+			vm_next;
+
+		vm_op(INT_XOR_MM)
+			int_a ^= int_b;
+			vm_next;
+
+		vm_op(INT_XOR_MI)
+			int_a ^= int_imm_b;
+			vm_next;
+
+		vm_op(INT_EQ_MM)
+			test_reg = int_a == int_b;
+			vm_next;
+
+		vm_op(INT_EQ_MI)
+			test_reg = int_a == int_imm_b;
+			vm_next;
+
+		vm_op(INT_NEQ_MM)
+			test_reg = int_a != int_b;
+			vm_next;
+
+		vm_op(INT_NEQ_MI)
+			test_reg = int_a != int_imm_b;
+			vm_next;
+
+		vm_op(INT_LT_MM)
+			test_reg = int_a < int_b;
+			vm_next;
+
+		vm_op(INT_LT_MI)
+			test_reg = int_a < int_imm_b;
+			vm_next;
+
+		vm_op(INT_LTE_MM)
+			test_reg = int_a <= int_b;
+			vm_next;
+
+		vm_op(INT_LTE_MI)
+			test_reg = int_a <= int_imm_b;
+			vm_next;
+
+		vm_op(INT_GT_MM)
+			test_reg = int_a > int_b;
+			vm_next;
+
+		vm_op(INT_GT_MI)
+			test_reg = int_a > int_imm_b;
+			vm_next;
+
+		vm_op(INT_GTE_MM)
+			test_reg = int_a >= int_b;
+			vm_next;
+
+		vm_op(INT_GTE_MI)
+			test_reg = int_a >= int_imm_b;
+			vm_next;
+
+		vm_op(INT_SHL_MC)
+			int_a = int_a << op->c; // count is stored in place of the second source
+			vm_next;
+
+		vm_op(INT_SHR_MC)
+			int_a = int_a >> op->c;
+			vm_next;
+
+		vm_op(INT_NEG_MM)
+			int_a = -int_b;
+			vm_next;
+
+		vm_op(INT_NOT_MM)
+			int_a = ~int_b;
+			vm_next;
+
+		vm_op(BOOL_AND_MM)
+			bool_a = bool_a & bool_b;
+			vm_next;
+
+		vm_op(BOOL_OR_MM)
+			bool_a = bool_a | bool_b;
+			vm_next;
+
+		vm_op(BOOL_XOR_MM)
+			bool_a = (bool_a | bool_b) & !(bool_a & bool_b);
+			vm_next;
+
+		vm_op(BOOL_NOT_MM)
+			bool_a = !bool_b;
+			vm_next;
+
+		vm_op(INT_FLT_MM)
+			int_a = mpl::wide_int(reg_b);
+			vm_next;
+
+		vm_op(FLT_INT_MM)
+			reg_a = mpl::wide_float(int_b);
+			vm_next;
+
+		vm_op(INT_BOOL_MM)
+			int_a = mpl::wide_int::mov_if_true(mpl::wide_int(0), mpl::wide_int(1), bool_b);
+			vm_next;
+
+		vm_op(FLT_MIN_MM)
+			reg_a = mpl::wide_float::min(reg_a, reg_b);
+			vm_next;
+
+		vm_op(FLT_MIN_MI)
+			reg_a = mpl::wide_float::min(reg_a, imm_b);
+			vm_next;
+
+		vm_op(FLT_MAX_MM)
+			reg_a = mpl::wide_float::max(reg_a, reg_b);
+			vm_next;
+
+		vm_op(FLT_MAX_MI)
+			reg_a = mpl::wide_float::max(reg_a, imm_b);
+			vm_next;
+
+		vm_op(FLT_SQRT_MM)
+			reg_a = mpl::wide_float::sqrt(reg_b);
+			vm_next;
 
-		default: return false;
+		vm_op(FLT_RSQRT_MM)
+			reg_a = mpl::wide_float(1.0f) / mpl::wide_float::sqrt(reg_b);
+			vm_next;
+
+		vm_op(FLT_ABS_MM)
+			reg_a = mpl::wide_float::max(reg_b, -reg_b);
+			vm_next;
+
+		vm_op(FLT_FLOOR_MM) {
+			// Conversion truncates towards zero, negative fractions round down one more
+			const mpl::wide_float t = mpl::wide_float(mpl::wide_int(reg_b));
+			reg_a = mpl::wide_float::mov_if_true(t, t - mpl::wide_float(1.0f), t > reg_b);
+			vm_next;
+		}
+
+		vm_op(FLT_CLAMP_MMM)
+			reg_a = mpl::wide_float::min(mpl::wide_float::max(reg_a, reg_b), reg_c);
+			vm_next;
+
+		vm_op(FLT_DOT3_MMM) {
+			const mpl::wide_float *b = &reg_b;
+			const mpl::wide_float *c = &reg_c;
+			reg_a = b[0] * c[0] + b[1] * c[1] + b[2] * c[2];
+			vm_next;
+		}
+
+		// Operands may overlap, the source is read in full before the destination is written
+		vm_op(FLT_NORM3_MM) {
+			mpl::wide_float       *a = &reg_a;
+			const mpl::wide_float *b = &reg_b;
+			const mpl::wide_float  x = b[0], y = b[1], z = b[2];
+			const mpl::wide_float  s = mpl::wide_float(1.0f) / mpl::wide_float::sqrt(x * x + y * y + z * z);
+			a[0] = x * s;
+			a[1] = y * s;
+			a[2] = z * s;
+			vm_next;
+		}
+
+		default:
+#if SWSL_THREADED_DISPATCH
+		invalid_handler:
+#endif
+			return false;
 		}
 	}
 
 	return false;
 }
+
+bool swsl::Shader::ExecuteJit(const InputArrays &inputs, mpl::wide_float *frame, const Block *blocks, int count) const
+{
+	if (m_code.GetSize() == 0) { return false; }
+
+	mpl::wide_bool          *mask_stack = (mpl::wide_bool*)(frame + m_frame_size);
+	const mpl::wide_float   *pool       = m_pool.GetSize() > 0 ? &m_pool[0] : NULL;
+	const JitCode::Function  function   = m_jit.GetFunction();
+	const Block             *last       = blocks + count;
+
+	mpl::wide_float *base[SEG_COUNT];
+	InitBase(base, frame, inputs);
+	for (const Block *block = blocks; block != last; ++block) {
+		BindBlock(base, block, inputs);
+		if (function(base, pool, mask_stack, &block->mask) == 0) { return false; }
+		MergeBlock(base[SEG_FRAGMENT], block);
+	}
+	return true;
+}
+
+swsl::ExecutionContext::ExecutionContext( void ) : m_shader(NULL), m_frame(NULL), m_frame_capacity(0)
+{
+	Shader::InputArrays inputs = { { NULL, 0 }, { NULL, 0 }, { NULL, 0 } };
+	m_inputs = inputs;
+}
+
+swsl::ExecutionContext::ExecutionContext(const Shader &shader) : m_shader(NULL), m_frame(NULL), m_frame_capacity(0)
+{
+	Shader::InputArrays inputs = { { NULL, 0 }, { NULL, 0 }, { NULL, 0 } };
+	m_inputs = inputs;
+	SetShader(shader);
+}
+
+// The frame starts on a cache line and is followed by at least one unused line, so frames
+// of contexts running on different threads never share a line
+void swsl::ExecutionContext::Reserve(int size)
+{
+	const int line = (CACHE_LINE_SIZE + (int)sizeof(mpl::wide_float) - 1) / (int)sizeof(mpl::wide_float);
+	if (size <= m_frame_capacity && m_frame != NULL) { return; }
+	m_storage.Create(mmlMax(size, 1) + line * 3);
+	const uintptr_t addr = (uintptr_t)(&m_storage[line]);
+	m_frame          = (mpl::wide_float*)((addr + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+	m_frame_capacity = mmlMax(size, 1);
+}
+
+void swsl::ExecutionContext::SetShader(const Shader &shader)
+{
+	m_shader = &shader;
+	Reserve(shader.GetStackSize());
+}
+
+const swsl::Shader *swsl::ExecutionContext::GetShader( void ) const
+{
+	return m_shader;
+}
+
+void swsl::ExecutionContext::SetInputArrays(const Shader::InputArrays &inputs)
+{
+	m_inputs = inputs;
+}
+
+bool swsl::ExecutionContext::IsValid( void ) const
+{
+	return m_shader != NULL && m_shader->GetErrorCount() == 0 && m_shader->IsCompatible(m_inputs);
+}
+
+bool swsl::ExecutionContext::Run(const mpl::wide_bool &frag_mask)
+{
+	Shader::Block block = { m_inputs.fragments.data, m_inputs.varying.data, frag_mask };
+	return RunBatch(&block, 1);
+}
+
+bool swsl::ExecutionContext::RunBatch(const Shader::Block *blocks, int count)
+{
+	if (m_shader == NULL) { return false; }
+	// The shader may have been reloaded with a larger stack since it was bound
+	Reserve(m_shader->GetStackSize());
+	return m_shader->RunFrame(m_inputs, m_frame, blocks, count SWSL_PROFILE_ARG(m_profile));
+}
+
+#if SWSL_PROFILE
+const swsl::Profile &swsl::ExecutionContext::GetProfile( void ) const
+{
+	return m_profile;
+}
+
+void swsl::ExecutionContext::ResetProfile( void )
+{
+	m_profile.Reset();
+}
+#endif
+
+swsl::SpecializationCache::SpecializationCache( void ) : m_shader(NULL), m_capacity(64)
+{}
+
+swsl::SpecializationCache::SpecializationCache(const Shader &shader) : m_shader(&shader), m_capacity(64)
+{}
+
+bool swsl::SpecializationCache::IsMatch(const Variant &variant, const Shader::InputArray &constants)
+{
+	if (variant.constants.GetSize() != constants.count * MPL_WIDTH) { return false; }
+	for (int i = 0; i < constants.count; ++i) {
+		float lanes[MPL_WIDTH];
+		constants.data[i].to_scalar(lanes);
+		for (int l = 0; l < MPL_WIDTH; ++l) {
+			if (!IsSameConstant(variant.constants[i * MPL_WIDTH + l], lanes[l])) { return false; }
+		}
+	}
+	return true;
+}
+
+void swsl::SpecializationCache::SetShader(const Shader &shader)
+{
+	Clear();
+	m_shader = &shader;
+}
+
+const swsl::Shader *swsl::SpecializationCache::GetShader( void ) const
+{
+	return m_shader;
+}
+
+// Sets of constants seen after the cache is full run the generic shader
+void swsl::SpecializationCache::SetCapacity(int capacity)
+{
+	m_capacity = mmlMax(capacity, 0);
+}
+
+int swsl::SpecializationCache::GetSize( void ) const
+{
+	return m_variants.GetSize();
+}
+
+// Invalidates every shader returned by Get
+void swsl::SpecializationCache::Clear( void )
+{
+	m_variants.RemoveAll();
+}
+
+// Constants are compared by representation. Sets the shader can not be specialized for are
+// remembered and run the generic shader, as do sets seen after the cache is full.
+const swsl::Shader *swsl::SpecializationCache::Get(const Shader::InputArray &constants)
+{
+	if (m_shader == NULL || (constants.count > 0 && constants.data == NULL)) { return m_shader; }
+
+	// 32-bit FNV-1a over every lane
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < constants.count; ++i) {
+		float lanes[MPL_WIDTH];
+		constants.data[i].to_scalar(lanes);
+		for (int l = 0; l < MPL_WIDTH; ++l) {
+			union { float f; unsigned int u; } x;
+			x.f = lanes[l];
+			for (int b = 0; b < 4; ++b) {
+				hash = (hash ^ ((x.u >> (b * 8)) & 0xFF)) * 16777619u;
+			}
+		}
+	}
+
+	for (const mtlItem<Variant> *i = m_variants.GetFirst(); i != NULL; i = i->GetNext()) {
+		const Variant &variant = i->GetItem();
+		if (variant.hash == hash && IsMatch(variant, constants)) {
+			return variant.shader.IsValid() ? &variant.shader : m_shader;
+		}
+	}
+	if (m_variants.GetSize() >= m_capacity) { return m_shader; }
+
+	Variant &variant = m_variants.AddLast();
+	variant.hash = hash;
+	variant.constants.Create(constants.count * MPL_WIDTH);
+	for (int i = 0; i < constants.count; ++i) {
+		constants.data[i].to_scalar(&variant.constants[i * MPL_WIDTH]);
+	}
+	return m_shader->Specialize(constants, variant.shader) ? &variant.shader : m_shader;
+}
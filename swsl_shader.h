@@ -7,18 +7,25 @@
 #include "MiniLib/MTL/mtlArray.h"
 
 #include "swsl_instr.h"
+#include "swsl_jit.h"
+#include "swsl_isa.h"
+#include "swsl_profile.h"
 
 namespace swsl
 {
 
 	typedef mtlString Binary;
 
+	class Image;
+
 	struct CompilerMessage
 	{
 		mtlString msg;
 		mtlString ref;
 	};
 
+	SWSL_ISA_BEGIN
+
 	class Shader
 	{
 	public:
@@ -35,6 +42,48 @@ namespace swsl
 			// InputArray in, inout;
 		};
 
+		// A block of MPL_WIDTH fragments to be processed by RunBatch
+		struct Block
+		{
+			mpl::wide_float       *fragments; // fragment register, read and written
+			const mpl::wide_float *varying;   // interpolated varying register
+			mpl::wide_bool         mask;      // coverage mask, only covered fragments are written
+		};
+
+		enum DispatchMode
+		{
+			DISPATCH_SWITCH,  // portable switch loop
+			DISPATCH_THREADED, // computed goto between handlers, falls back to DISPATCH_SWITCH if unsupported by compiler
+			DISPATCH_JIT       // native code, falls back to DISPATCH_THREADED if unsupported by platform or program
+		};
+
+	private:
+		// Instruction decoded at load time to a fixed size record
+		struct Op
+		{
+			InstructionSet instr;
+			addr_t         a;     // destination offset into segment seg_a
+			addr_t         b;     // source offset into segment seg_b, constant pool index or jump target
+			addr_t         c;     // second source offset into segment seg_c or shift count
+			unsigned char  seg_a;
+			unsigned char  seg_b;
+			unsigned char  seg_c;
+			addr_t         depth; // mask stack depth before the instruction, MASK_UNREACHABLE if never executed
+		};
+
+		// Base registers the VM addresses its operands through
+		enum Segment
+		{
+			SEG_CONSTANT,
+			SEG_VARYING,
+			SEG_FRAGMENT,
+			SEG_LOCAL,
+			SEG_COUNT
+		};
+
+		friend class JitCompiler;
+		friend class ExecutionContext;
+
 	private:
 		enum MetaData
 		{
@@ -44,27 +93,143 @@ namespace swsl
 
 	private:
 		static const addr_t STACK_SIZE_MASK = (addr_t)(-1);
-		static const int    STACK_SIZE      = ((int)STACK_SIZE_MASK) + 1;
+		static const int    STACK_SIZE      = ((int)STACK_SIZE_MASK) + 1; // upper limit, actual size is computed per program
+		static const addr_t MASK_UNREACHABLE = (addr_t)(-1);
 
 	private:
 		mtlArray<Instruction>     m_program;
+		mtlArray<Op>              m_code;
+		int                       m_entry;
+		int                       m_frame_size;
+		int                       m_mask_depth;
+		int                       m_segment_size[SEG_COUNT];
+		int                       m_segment_offset[SEG_COUNT]; // offset into frame, -1 if addressed in place
+		mtlArray<addr_t>          m_frag_loads;  // fragment components the program reads
+		mtlArray<addr_t>          m_frag_stores; // fragment components the program writes
+		mtlArray<mpl::wide_float> m_pool;        // immediates referenced by _MI instructions
+		mtlArray<float>           m_image_pool;  // constant pool of a loaded image, _MI operands are indices into it
+		bool                      m_from_image;
+		DispatchMode              m_dispatch;
+		JitCode                   m_jit;
+		bool                      m_jit_compiled; // m_jit is up to date with m_code, even if the program was rejected
 		InputArrays              *m_inputs;
 		mtlList<CompilerMessage>  m_errors;
 		mtlList<CompilerMessage>  m_warnings;
 
+	private:
+		void AddError(const mtlChars &msg, int iptr);
+		void MapSlot(addr_t slot, unsigned char &seg, addr_t &offset) const;
+		bool IsInSegment(unsigned char seg, addr_t offset, int width) const;
+		bool Decode( void );
+		void CompileJit( void );
+		bool Verify(const mtlArray<int> &op_offset);
+		void InitBase(mpl::wide_float **base, mpl::wide_float *frame, const InputArrays &inputs) const;
+		void BindBlock(mpl::wide_float **base, const Block *block, const InputArrays &inputs) const;
+		void MergeBlock(const mpl::wide_float *fragment_data, const Block *block) const;
+		bool RunFrame(const InputArrays &inputs, mpl::wide_float *frame, const Block *blocks, int count SWSL_PROFILE_ARG(Profile &profile)) const;
+		bool Dispatch(const InputArrays &inputs, mpl::wide_float *frame, const Block *blocks, int count SWSL_PROFILE_ARG(Profile &profile)) const;
+		template < bool threaded >
+		bool Execute(const InputArrays &inputs, mpl::wide_float *frame, const Block *blocks, int count SWSL_PROFILE_ARG(Profile &profile)) const;
+		bool ExecuteJit(const InputArrays &inputs, mpl::wide_float *frame, const Block *blocks, int count) const;
+
 	public:
-		Shader( void ) : m_inputs(NULL) {}
+		Shader( void );
 
 		void                            Delete( void );
 		bool                            IsValid( void ) const;
+		bool                            IsCompatible(const InputArrays &inputs) const;
+		int                             GetStackSize( void ) const;
 		int                             GetErrorCount( void ) const;
 		int                             GetWarningCount( void ) const;
-		void                            SetInputArrays(InputArrays &inputs);
+		void                            SetProgram(const swsl::Instruction *program, int size);
+		void                            SetImage(const swsl::Image &image, int entry);
+		bool                            Specialize(const InputArray &constants, Shader &out) const;
+		void                            SetDispatchMode(DispatchMode mode);
+		DispatchMode                    GetDispatchMode( void ) const;
+		void                            SetInputLayout(int constants, int varyings, int fragments);
+		void                            SetInputArrays(InputArrays &inputs); // Run and RunBatch read through the bound arrays, use an ExecutionContext per thread instead
 		const mtlItem<CompilerMessage> *GetErrors( void ) const;
 		const mtlItem<CompilerMessage> *GetWarnings( void ) const;
 		bool                            Run(const mpl::wide_bool &frag_mask) const;
+		bool                            RunBatch(const Block *blocks, int count) const;
 	};
 
+	// Per thread state for running a shared shader. A loaded shader is not written to while it runs,
+	// so any number of contexts can run the same shader at once without locking. Each context owns
+	// its input bindings and the frame the program runs in.
+	class ExecutionContext
+	{
+	private:
+		static const int CACHE_LINE_SIZE = 64;
+
+	private:
+		const Shader              *m_shader;
+		Shader::InputArrays        m_inputs;
+		mtlArray<mpl::wide_float>  m_storage;
+		mpl::wide_float           *m_frame;          // cache line aligned view into m_storage
+		int                        m_frame_capacity;
+#if SWSL_PROFILE
+		Profile                    m_profile;
+#endif
+
+	private:
+		ExecutionContext(const ExecutionContext&) {}
+		ExecutionContext &operator=(const ExecutionContext&) { return *this; }
+		void Reserve(int size);
+
+	public:
+		ExecutionContext( void );
+		explicit ExecutionContext(const Shader &shader);
+
+		void           SetShader(const Shader &shader);
+		const Shader  *GetShader( void ) const;
+		void           SetInputArrays(const Shader::InputArrays &inputs);
+		bool           IsValid( void ) const;
+		bool           Run(const mpl::wide_bool &frag_mask);
+		bool           RunBatch(const Shader::Block *blocks, int count);
+#if SWSL_PROFILE
+		const Profile &GetProfile( void ) const;
+		void           ResetProfile( void );
+#endif
+	};
+
+	// Variants of a shader specialized for the sets of constants it is run with. Variants are kept until the cache
+	// is cleared, so the shaders it returns stay valid while contexts run them. The cache is not synchronized,
+	// variants are looked up on one thread and handed to the execution contexts from there.
+	class SpecializationCache
+	{
+	private:
+		struct Variant
+		{
+			mtlArray<float> constants; // every lane of every constant
+			unsigned int    hash;
+			Shader          shader;
+		};
+
+	private:
+		const Shader     *m_shader;
+		mtlList<Variant>  m_variants;
+		int               m_capacity;
+
+	private:
+		SpecializationCache(const SpecializationCache&) {}
+		SpecializationCache &operator=(const SpecializationCache&) { return *this; }
+		static bool IsMatch(const Variant &variant, const Shader::InputArray &constants);
+
+	public:
+		SpecializationCache( void );
+		explicit SpecializationCache(const Shader &shader);
+
+		void          SetShader(const Shader &shader);
+		const Shader *GetShader( void ) const;
+		void          SetCapacity(int capacity);
+		int           GetSize( void ) const;
+		void          Clear( void );
+		const Shader *Get(const Shader::InputArray &constants);
+	};
+
+	SWSL_ISA_END
+
 }
 
 #endif // SHADER_H
@@ -0,0 +1,92 @@
+#include "swsl_thread.h"
+
+swsl::WorkerPool::WorkerPool( void ) : m_job(NULL), m_data(NULL), m_generation(0), m_running(0), m_quit(false)
+{}
+
+swsl::WorkerPool::~WorkerPool( void )
+{
+	Destroy();
+}
+
+void swsl::WorkerPool::Work(int worker)
+{
+	unsigned int generation = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		while (!m_quit && m_generation == generation) {
+			m_start.wait(lock);
+		}
+		if (m_quit) { return; }
+		generation = m_generation;
+		const Job  job  = m_job;
+		void      *data = m_data;
+		lock.unlock();
+		job(data, worker);
+		lock.lock();
+		if (--m_running == 0) {
+			m_done.notify_one();
+		}
+	}
+}
+
+// Thread count includes the calling thread
+void swsl::WorkerPool::Create(int thread_count)
+{
+	Destroy();
+	if (thread_count <= 1) { return; }
+	m_threads.Create(thread_count - 1);
+	for (int i = 0; i < m_threads.GetSize(); ++i) {
+		m_threads[i] = std::thread(&WorkerPool::Work, this, i + 1);
+	}
+}
+
+void swsl::WorkerPool::Destroy( void )
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_start.notify_all();
+	for (int i = 0; i < m_threads.GetSize(); ++i) {
+		if (m_threads[i].joinable()) {
+			m_threads[i].join();
+		}
+	}
+	m_threads.Free();
+	m_quit       = false;
+	m_generation = 0;
+	m_running    = 0;
+}
+
+int swsl::WorkerPool::GetThreadCount( void ) const
+{
+	return m_threads.GetSize() + 1;
+}
+
+// Returns when every worker has returned from the job
+void swsl::WorkerPool::Run(swsl::WorkerPool::Job job, void *data)
+{
+	if (m_threads.GetSize() == 0) {
+		job(data, 0);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job     = job;
+		m_data    = data;
+		m_running = m_threads.GetSize();
+		++m_generation;
+	}
+	m_start.notify_all();
+	job(data, 0);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_running > 0) {
+		m_done.wait(lock);
+	}
+}
+
+int swsl::WorkerPool::GetHardwareThreadCount( void )
+{
+	const int count = (int)std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
@@ -0,0 +1,50 @@
+#ifndef SWSL_THREAD_H_INCLUDED__
+#define SWSL_THREAD_H_INCLUDED__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "MiniLib/MTL/mtlArray.h"
+
+namespace swsl
+{
+
+	// A fixed set of threads that run the same job together. The calling thread takes part as worker 0,
+	// so a pool of one thread runs jobs without any synchronization.
+	class WorkerPool
+	{
+	public:
+		typedef void (*Job)(void *data, int worker);
+
+	private:
+		mtlArray<std::thread>   m_threads;
+		std::mutex              m_mutex;
+		std::condition_variable m_start;
+		std::condition_variable m_done;
+		Job                     m_job;
+		void                   *m_data;
+		unsigned int            m_generation; // incremented for every job
+		int                     m_running;    // threads still working on the current job
+		bool                    m_quit;
+
+	private:
+		WorkerPool(const WorkerPool&) {}
+		WorkerPool &operator=(const WorkerPool&) { return *this; }
+		void Work(int worker);
+
+	public:
+		WorkerPool( void );
+		~WorkerPool( void );
+
+		void Create(int thread_count);
+		void Destroy( void );
+		int  GetThreadCount( void ) const;
+		void Run(Job job, void *data);
+
+		static int GetHardwareThreadCount( void );
+	};
+
+}
+
+#endif // SWSL_THREAD_H_INCLUDED__